@@ -0,0 +1,336 @@
+/*
+ ballistics.c
+ RMS, VU and PPM meter ballistics
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ballistics.h"
+#include "channel_store.h"
+#include "peak_kernel.h"
+
+/* A VU meter reaches 99% of a step in 300 ms */
+#define VU_TIME_CONSTANT (0.3f / 4.605f)
+/* A type I PPM reads 1 dB under a tone burst of 10 ms */
+#define PPM_ATTACK_TIME_CONSTANT (0.010f / 2.216f)
+/* integrated over blocks of this long */
+#define PPM_BLOCK_SECONDS 0.001f
+/* and falls back 20 dB in 1.5 s */
+#define PPM_RELEASE_DB_PER_SECOND (20.0f / 1.5f)
+
+static const char *mode_names[METER_MODES] = { "peak", "rms", "vu", "ppm",
+		"tp" };
+
+int ballistics_init(struct ballistics_t *ballistics, unsigned int channels,
+		float sample_rate, float rms_window) {
+	memset(ballistics, 0, sizeof(struct ballistics_t));
+	ballistics->channels = channels;
+	ballistics->sample_rate = sample_rate;
+	ballistics->rms_window = rms_window;
+	ballistics->rms_ring = calloc((size_t) channels * RMS_MAX_BLOCKS,
+			sizeof(float));
+	ballistics->rms_sum = calloc(channels, sizeof(double));
+	ballistics->vu = calloc(channels, sizeof(float));
+	ballistics->ppm = calloc(channels, sizeof(float));
+	ballistics->true_peak_history = calloc(
+			(size_t) channels * TRUE_PEAK_HISTORY, sizeof(float));
+	ballistics->running = calloc(channels, sizeof(unsigned char));
+	ballistics->rms_level = calloc(channels, sizeof(_Atomic uint32_t));
+	ballistics->vu_level = calloc(channels, sizeof(_Atomic uint32_t));
+	ballistics->ppm_level = calloc(channels, sizeof(_Atomic uint32_t));
+	ballistics->true_peak = calloc(channels, sizeof(_Atomic uint32_t));
+	ballistics->wanted = calloc(channels, sizeof(_Atomic unsigned char));
+	if (!ballistics->rms_ring || !ballistics->rms_sum || !ballistics->vu
+			|| !ballistics->ppm || !ballistics->true_peak_history
+			|| !ballistics->rms_level || !ballistics->vu_level
+			|| !ballistics->ppm_level || !ballistics->true_peak
+			|| !ballistics->running || !ballistics->wanted) {
+		ballistics_free(ballistics);
+		return -1;
+	}
+	return 0;
+}
+
+void ballistics_free(struct ballistics_t *ballistics) {
+	free(ballistics->rms_ring);
+	free(ballistics->rms_sum);
+	free(ballistics->vu);
+	free(ballistics->ppm);
+	free(ballistics->true_peak_history);
+	free(ballistics->rms_level);
+	free(ballistics->vu_level);
+	free(ballistics->ppm_level);
+	free(ballistics->true_peak);
+	free(ballistics->running);
+	free(ballistics->wanted);
+	memset(ballistics, 0, sizeof(struct ballistics_t));
+}
+
+int ballistics_begin_period(struct ballistics_t *ballistics,
+		jack_nframes_t nframes) {
+	int cut = 0;
+	if (ballistics->channels == 0) {
+		return 0;
+	}
+	if (nframes != ballistics->nframes) {
+		// the period changed, so the window and coefficients change with it
+		float period = nframes / ballistics->sample_rate;
+		unsigned int blocks = (unsigned int) (ballistics->rms_window / period
+				+ 0.5f);
+		if (blocks < 1) {
+			blocks = 1;
+		} else if (blocks > RMS_MAX_BLOCKS) {
+			blocks = RMS_MAX_BLOCKS;
+			cut = 1;
+		}
+		ballistics->nframes = nframes;
+		ballistics->rms_blocks = blocks;
+		ballistics->rms_pos = 0;
+		ballistics->vu_coeff = 1.0f - expf(-period / VU_TIME_CONSTANT);
+		jack_nframes_t block = (jack_nframes_t) (PPM_BLOCK_SECONDS
+				* ballistics->sample_rate + 0.5f);
+		if (block < 1) {
+			block = 1;
+		} else if (block > nframes) {
+			block = nframes;
+		}
+		ballistics->ppm_block = block;
+		ballistics->ppm_attack = 1.0f
+				- expf(-(block / ballistics->sample_rate)
+								/ PPM_ATTACK_TIME_CONSTANT);
+		ballistics->ppm_attack_tail = 1.0f
+				- expf(-((nframes % block) / ballistics->sample_rate)
+								/ PPM_ATTACK_TIME_CONSTANT);
+		ballistics->ppm_release = powf(10.0f,
+				-PPM_RELEASE_DB_PER_SECOND * period / 20.0f);
+		memset(ballistics->rms_ring, 0,
+				(size_t) ballistics->channels * RMS_MAX_BLOCKS * sizeof(float));
+		memset(ballistics->rms_sum, 0, ballistics->channels * sizeof(double));
+	} else if (++ballistics->rms_pos >= ballistics->rms_blocks) {
+		ballistics->rms_pos = 0;
+	}
+	return cut;
+}
+
+float ballistics_rms_window(const struct ballistics_t *ballistics) {
+	return ballistics->rms_blocks * (ballistics->nframes
+			/ ballistics->sample_rate);
+}
+
+/* samples run through the true peak kernel at a time */
+#define TRUE_PEAK_CHUNK 256
+
+static inline void store_level(_Atomic uint32_t *slot, float level) {
+	atomic_store_explicit(slot, peak_to_bits(level), memory_order_relaxed);
+}
+
+/*
+ * The true peak kernel reads the samples before its buffer, so the samples
+ * are copied in behind the history.  Copying the whole period rather than
+ * just its first samples keeps the kernel on full vectors, the scalar tail
+ * costs far more than the copy.  The filter's taps are under unity, so an
+ * impulse would read under its sample; the true peak starts from the sample
+ * peak so it never reads less.
+ */
+static float true_peak_channel(float *history, const float *in,
+		jack_nframes_t nframes, float sample_peak) {
+	float work[TRUE_PEAK_HISTORY + TRUE_PEAK_CHUNK];
+	float peak = sample_peak;
+	memcpy(work, history, TRUE_PEAK_HISTORY * sizeof(float));
+	while (nframes > 0) {
+		jack_nframes_t n = nframes < TRUE_PEAK_CHUNK ? nframes : TRUE_PEAK_CHUNK;
+		memcpy(work + TRUE_PEAK_HISTORY, in, n * sizeof(float));
+		float p = true_peak_max(work + TRUE_PEAK_HISTORY, n);
+		peak = p > peak ? p : peak;
+		memmove(work, work + n, TRUE_PEAK_HISTORY * sizeof(float));
+		in += n;
+		nframes -= n;
+	}
+	memcpy(history, work, TRUE_PEAK_HISTORY * sizeof(float));
+	return peak;
+}
+
+/*
+ * The PPM rises quickly to the peak and falls back at a fixed rate.  The
+ * attack runs on each block so a short burst charges it for as long as it
+ * lasts rather than for the whole period.
+ */
+static float ppm_channel(struct ballistics_t *ballistics, unsigned int channel,
+		const float *in, jack_nframes_t nframes) {
+	float ppm = ballistics->ppm[channel] * ballistics->ppm_release;
+	float peak = 0.0f;
+	jack_nframes_t block = ballistics->ppm_block;
+	while (nframes > 0) {
+		jack_nframes_t n = nframes < block ? nframes : block;
+		float p = peak_abs_max(in, n);
+		if (p > ppm) {
+			ppm += (n == block ? ballistics->ppm_attack :
+					ballistics->ppm_attack_tail) * (p - ppm);
+		}
+		peak = p > peak ? p : peak;
+		in += n;
+		nframes -= n;
+	}
+	ballistics->ppm[channel] = ppm;
+	return peak;
+}
+
+/*
+ * Clear the state of the modes a channel starts to run again, it is stale
+ * from when the channel last ran them.
+ */
+static void restart_modes(struct ballistics_t *ballistics, unsigned int channel,
+		unsigned int modes) {
+	if (modes & METER_MODE_BIT(METER_RMS)) {
+		memset(&ballistics->rms_ring[(size_t) channel * RMS_MAX_BLOCKS], 0,
+				RMS_MAX_BLOCKS * sizeof(float));
+		ballistics->rms_sum[channel] = 0.0;
+	}
+	if (modes & METER_MODE_BIT(METER_VU)) {
+		ballistics->vu[channel] = 0.0f;
+	}
+	if (modes & METER_MODE_BIT(METER_PPM)) {
+		ballistics->ppm[channel] = 0.0f;
+	}
+	if (modes & METER_MODE_BIT(METER_TRUE_PEAK)) {
+		// start the filter again from silence
+		memset(&ballistics->true_peak_history[(size_t) channel
+				* TRUE_PEAK_HISTORY], 0, TRUE_PEAK_HISTORY * sizeof(float));
+	}
+}
+
+float ballistics_channel(struct ballistics_t *ballistics, unsigned int channel,
+		const float *in, jack_nframes_t nframes) {
+	if (channel >= ballistics->channels) {
+		return peak_abs_max(in, nframes);
+	}
+	unsigned int wanted = atomic_load_explicit(&ballistics->wanted[channel],
+			memory_order_relaxed);
+	unsigned int starting = wanted & ~ballistics->running[channel];
+	ballistics->running[channel] = wanted;
+	if (starting) {
+		restart_modes(ballistics, channel, starting);
+	}
+
+	// the PPM finds the peak in its pass over the blocks
+	float peak;
+	if (wanted & METER_MODE_BIT(METER_PPM)) {
+		peak = ppm_channel(ballistics, channel, in, nframes);
+		store_level(&ballistics->ppm_level[channel], ballistics->ppm[channel]);
+	} else {
+		peak = peak_abs_max(in, nframes);
+	}
+
+	if (wanted & (METER_MODE_BIT(METER_RMS) | METER_MODE_BIT(METER_VU))) {
+		float energy = sum_squares(in, nframes);
+		if (wanted & METER_MODE_BIT(METER_RMS)) {
+			float *ring = &ballistics->rms_ring[(size_t) channel
+					* RMS_MAX_BLOCKS];
+			unsigned int pos = ballistics->rms_pos;
+
+			// slide the window on by one period
+			double sum = ballistics->rms_sum[channel] + energy - ring[pos];
+			ring[pos] = energy;
+			if (sum < 0.0) {
+				sum = 0.0;
+			}
+			ballistics->rms_sum[channel] = sum;
+			store_level(&ballistics->rms_level[channel],
+					sqrtf(sum / ((double) ballistics->rms_blocks * nframes)));
+		}
+		if (wanted & METER_MODE_BIT(METER_VU)) {
+			// the VU needle follows the period's RMS
+			float period_rms = sqrtf(energy / nframes);
+			float vu = ballistics->vu[channel];
+			vu += ballistics->vu_coeff * (period_rms - vu);
+			ballistics->vu[channel] = vu;
+			store_level(&ballistics->vu_level[channel], vu);
+		}
+	}
+
+	if (wanted & METER_MODE_BIT(METER_TRUE_PEAK)) {
+		float *history = &ballistics->true_peak_history[(size_t) channel
+				* TRUE_PEAK_HISTORY];
+		publish_peak(&ballistics->true_peak[channel],
+				true_peak_channel(history, in, nframes, peak));
+	}
+	return peak;
+}
+
+void ballistics_want(struct ballistics_t *ballistics, unsigned int channel,
+		unsigned int modes) {
+	if (channel < ballistics->channels) {
+		atomic_store_explicit(&ballistics->wanted[channel],
+				modes & METER_ALL_MODES, memory_order_relaxed);
+	}
+}
+
+float ballistics_take_true_peak(struct ballistics_t *ballistics,
+		unsigned int channel) {
+	if (channel >= ballistics->channels) {
+		return 0.0f;
+	}
+	return take_peak(&ballistics->true_peak[channel]);
+}
+
+float ballistics_peek_true_peak(struct ballistics_t *ballistics,
+		unsigned int channel) {
+	if (channel >= ballistics->channels) {
+		return 0.0f;
+	}
+	return peek_peak(&ballistics->true_peak[channel]);
+}
+
+float ballistics_level(struct ballistics_t *ballistics, unsigned int channel,
+		enum meter_mode_t mode) {
+	_Atomic uint32_t *slot;
+	if (channel >= ballistics->channels) {
+		return 0.0f;
+	}
+	switch (mode) {
+	case METER_RMS:
+		slot = &ballistics->rms_level[channel];
+		break;
+	case METER_VU:
+		slot = &ballistics->vu_level[channel];
+		break;
+	case METER_PPM:
+		slot = &ballistics->ppm_level[channel];
+		break;
+	default:
+		return 0.0f;
+	}
+	return bits_to_peak(atomic_load_explicit(slot, memory_order_relaxed));
+}
+
+int meter_mode_parse(const char *name) {
+	int mode;
+	for (mode = 0; mode < METER_MODES; mode++) {
+		if (!strcmp(name, mode_names[mode])) {
+			return mode;
+		}
+	}
+	return -1;
+}
+
+const char* meter_mode_name(enum meter_mode_t mode) {
+	return mode < METER_MODES ? mode_names[mode] : "?";
+}
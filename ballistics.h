@@ -0,0 +1,148 @@
+/*
+ ballistics.h
+ RMS, VU and PPM meter ballistics
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef BALLISTICS_H
+#define BALLISTICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <jack/jack.h>
+
+/* What a channel's meter shows */
+enum meter_mode_t {
+	METER_PEAK, /* sample peak since the last frame */
+	METER_RMS, /* RMS over a sliding window */
+	METER_VU, /* VU meter, 300 ms integration */
+	METER_PPM, /* IEC 60268-10 type I peak programme meter */
+	METER_TRUE_PEAK, /* BS.1770 4x oversampled peak since the last frame */
+	METER_MODES
+};
+
+/* modes are wanted as a mask of these bits, the peak is always metered */
+#define METER_MODE_BIT(mode) (1u << (mode))
+#define METER_ALL_MODES (METER_MODE_BIT(METER_MODES) - 1)
+
+#define DEFAULT_RMS_WINDOW 0.3f
+/* the most periods in the RMS window, a longer window is cut to this */
+#define RMS_MAX_BLOCKS 1024
+
+/*
+ * The JACK thread works out the energy of each period and runs the
+ * ballistics once per period, for the modes each channel wants.  The RMS window is a ring of period energies
+ * with a running sum, so the cost per sample is the energy kernel alone.
+ * The PPM attack is the exception, it integrates the peaks of blocks of about
+ * 1 ms so it reads the same whatever the period.  The levels are published as
+ * float bits the display loads whenever it wants them.
+ */
+struct ballistics_t {
+	unsigned int channels;
+	float sample_rate;
+	float rms_window;
+
+	/* coefficients for periods of nframes, set by ballistics_begin_period() */
+	jack_nframes_t nframes;
+	unsigned int rms_blocks;
+	unsigned int rms_pos;
+	float vu_coeff;
+	/* the PPM attack of a block, and of the shorter block ending a period */
+	jack_nframes_t ppm_block;
+	float ppm_attack;
+	float ppm_attack_tail;
+	float ppm_release;
+
+	/* JACK thread state, rms_ring holds RMS_MAX_BLOCKS energies per channel */
+	float *rms_ring;
+	double *rms_sum;
+	float *vu;
+	float *ppm;
+	/* the last TRUE_PEAK_HISTORY samples of each channel */
+	float *true_peak_history;
+	/* the modes each channel ran last period */
+	unsigned char *running;
+
+	/* published levels, as float bits */
+	_Atomic uint32_t *rms_level;
+	_Atomic uint32_t *vu_level;
+	_Atomic uint32_t *ppm_level;
+	/* true peak since it was last taken, see publish_peak() */
+	_Atomic uint32_t *true_peak;
+	/* set by the display to the modes each channel wants */
+	_Atomic unsigned char *wanted;
+};
+
+/**
+ * allocate the state for a number of channels.
+ * @param rms_window the length of the RMS window in seconds
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int ballistics_init(struct ballistics_t *ballistics, unsigned int channels,
+		float sample_rate, float rms_window);
+
+void ballistics_free(struct ballistics_t *ballistics);
+
+/**
+ * called by the JACK thread at the start of each period.
+ * @return 1 if the period changed and the RMS window had to be cut to
+ * RMS_MAX_BLOCKS periods, 0 otherwise
+ */
+int ballistics_begin_period(struct ballistics_t *ballistics,
+		jack_nframes_t nframes);
+
+/* The length of the RMS window in use, in seconds */
+float ballistics_rms_window(const struct ballistics_t *ballistics);
+
+/**
+ * called by the JACK thread with each channel's samples.
+ * @return the sample peak of the samples
+ */
+float ballistics_channel(struct ballistics_t *ballistics, unsigned int channel,
+		const float *in, jack_nframes_t nframes);
+
+/* The latest linear level of a channel for the RMS, VU or PPM mode it wants */
+float ballistics_level(struct ballistics_t *ballistics, unsigned int channel,
+		enum meter_mode_t mode);
+
+/**
+ * the mode with a name.
+ * @return the mode, or -1 if no mode has the name
+ */
+int meter_mode_parse(const char *name);
+
+/**
+ * choose the modes that run for a channel.  The ballistics cost far more than
+ * the peak, so only the modes a channel shows or records run, and a mode
+ * starts again from silence when it comes back.
+ * @param modes a mask of METER_MODE_BIT()s
+ */
+void ballistics_want(struct ballistics_t *ballistics, unsigned int channel,
+		unsigned int modes);
+
+/* Take the true peak of a channel since the last call */
+float ballistics_take_true_peak(struct ballistics_t *ballistics,
+		unsigned int channel);
+
+/* The true peak of a channel since it was last taken, leaving it in place */
+float ballistics_peek_true_peak(struct ballistics_t *ballistics,
+		unsigned int channel);
+
+const char* meter_mode_name(enum meter_mode_t mode);
+
+#endif /* BALLISTICS_H */
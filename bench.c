@@ -0,0 +1,992 @@
+/*
+ bench.c
+ Benchmarks for the metering code of cuimhne_jackmeter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <getopt.h>
+
+#include "bench.h"
+#include "cuimhne_jackmeter.h"
+#include "peak_kernel.h"
+
+#define BENCH_MIN_FRAMES 16
+#define BENCH_MAX_FRAMES 4096
+/* samples processed per kernel and buffer size */
+#define BENCH_SAMPLES (64 * 1024 * 1024)
+
+/* seconds of audio run through the simulated engine */
+#define ENGINE_SECONDS 10
+/* the simulated engine reports an xrun this often */
+#define ENGINE_XRUN_SECONDS 2
+#define ENGINE_SIGNAL_LEN (64 * 1024)
+#define ENGINE_DEFAULT_RATE 48000
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The per sample loop process_peak used before the kernels */
+static float reference_peak(const float *buf, size_t n) {
+	float peak = 0.0f;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		const float s = fabs(buf[i]);
+		if (s > peak) {
+			peak = s;
+		}
+	}
+	return peak;
+}
+
+/* Keeps the compiler from discarding the kernel calls */
+static volatile float bench_sink;
+
+static double time_kernel(peak_kernel_t kernel, const float *buf,
+		size_t frames) {
+	size_t rounds = BENCH_SAMPLES / frames;
+	size_t r;
+	float peak = 0.0f;
+	double start = now_ns();
+	for (r = 0; r < rounds; r++) {
+		float p = kernel(buf + (r & 7), frames);
+		peak = p > peak ? p : peak;
+	}
+	double elapsed = now_ns() - start;
+	bench_sink = peak;
+	return elapsed / rounds;
+}
+
+static int bench_peak_kernels(void) {
+	const struct peak_kernel_info *info;
+	size_t frames;
+	size_t i;
+	int failures = 0;
+	// a little slack past the end lets each round start at a different offset
+	float *buf = (float*) malloc((BENCH_MAX_FRAMES + 8) * sizeof(float));
+
+	srand(1);
+	for (i = 0; i < BENCH_MAX_FRAMES + 8; i++) {
+		buf[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+	}
+
+	printf("peak kernels, ns per buffer (ns per sample)\n");
+	printf("%6s %16s", "frames", "loop");
+	for (info = peak_kernels; info->name; info++) {
+		if (info->supported()) {
+			printf(" %16s", info->name);
+		}
+	}
+	printf("\n");
+
+	for (frames = BENCH_MIN_FRAMES; frames <= BENCH_MAX_FRAMES; frames *= 2) {
+		float expected = reference_peak(buf, frames);
+		double ns = time_kernel(reference_peak, buf, frames);
+		printf("%6zu %9.1f (%4.2f)", frames, ns, ns / frames);
+		for (info = peak_kernels; info->name; info++) {
+			if (!info->supported()) {
+				continue;
+			}
+			if (info->kernel(buf, frames) != expected) {
+				fprintf(stderr, "%s kernel disagrees with the loop at %zu frames\n",
+						info->name, frames);
+				failures++;
+			}
+			ns = time_kernel(info->kernel, buf, frames);
+			printf(" %9.1f (%4.2f)", ns, ns / frames);
+		}
+		printf("\n");
+	}
+	printf("selected kernel: %s\n\n", peak_kernel_init());
+	free(buf);
+	return failures;
+}
+
+/*
+ * PEAK HANDOFF
+ *
+ * A JACK thread stand-in publishes the peak of a period of noise at a random
+ * level, as fast as it can, while a display stand-in takes the peak after
+ * every period or two.  The display numbers its takes; the JACK side reads
+ * the number before and after each publish, so the peak must be in one of
+ * the takes between them or the one after.  A take that read less than a
+ * peak published in its window means the peak was lost.
+ */
+#define HANDOFF_PERIODS (256 * 1024)
+#define HANDOFF_MIN_FRAMES 16
+#define HANDOFF_MAX_FRAMES 64
+
+struct handoff_t {
+	const float *signal;
+	const float *gain;
+	size_t frames;
+	_Atomic uint32_t slot;
+	atomic_uint published;
+	/* the periods published when the display last took the peak */
+	atomic_uint seen;
+	atomic_uint takes;
+	atomic_int done;
+	float *peak;
+	unsigned int *before;
+	unsigned int *after;
+	float *taken;
+};
+
+static void* handoff_publisher(void *arg) {
+	struct handoff_t *handoff = (struct handoff_t*) arg;
+	unsigned int i;
+	for (i = 0; i < HANDOFF_PERIODS; i++) {
+		// keep within a couple of periods of the display so the takes race
+		// the publishes rather than come after a whole run of them
+		while (i - atomic_load_explicit(&handoff->seen, memory_order_relaxed)
+				> 2) {
+			sched_yield();
+		}
+		float peak = peak_abs_max(handoff->signal + (i & 1023), handoff->frames)
+				* handoff->gain[i & 1023];
+		handoff->peak[i] = peak;
+		handoff->before[i] = atomic_load_explicit(&handoff->takes,
+				memory_order_acquire);
+		publish_peak(&handoff->slot, peak);
+		handoff->after[i] = atomic_load_explicit(&handoff->takes,
+				memory_order_acquire);
+		atomic_store_explicit(&handoff->published, i + 1, memory_order_release);
+	}
+	atomic_store(&handoff->done, 1);
+	return NULL;
+}
+
+static void* handoff_taker(void *arg) {
+	struct handoff_t *handoff = (struct handoff_t*) arg;
+	unsigned int seen = 0;
+	unsigned int take = 0;
+	for (;;) {
+		int done = atomic_load(&handoff->done);
+		unsigned int published = atomic_load_explicit(&handoff->published,
+				memory_order_acquire);
+		if (published == seen && !done) {
+			sched_yield();
+			continue;
+		}
+		seen = published;
+		atomic_store_explicit(&handoff->seen, seen, memory_order_relaxed);
+		handoff->taken[take] = take_peak(&handoff->slot);
+		atomic_store_explicit(&handoff->takes, ++take, memory_order_release);
+		if (done && published == HANDOFF_PERIODS) {
+			return NULL;
+		}
+	}
+}
+
+/* Run the handoff at one period size, returns the peaks lost */
+static unsigned int run_handoff(struct handoff_t *handoff, size_t frames) {
+	pthread_t publisher;
+	pthread_t taker;
+	unsigned int lost = 0;
+	unsigned int i;
+	handoff->frames = frames;
+	atomic_store(&handoff->slot, 0);
+	atomic_store(&handoff->published, 0);
+	atomic_store(&handoff->seen, 0);
+	atomic_store(&handoff->takes, 0);
+	atomic_store(&handoff->done, 0);
+	pthread_create(&taker, NULL, handoff_taker, handoff);
+	pthread_create(&publisher, NULL, handoff_publisher, handoff);
+	pthread_join(publisher, NULL);
+	pthread_join(taker, NULL);
+	unsigned int takes = atomic_load(&handoff->takes);
+	for (i = 0; i < HANDOFF_PERIODS; i++) {
+		unsigned int take;
+		unsigned int last = handoff->after[i] + 1;
+		float highest = 0.0f;
+		if (last >= takes) {
+			last = takes - 1;
+		}
+		for (take = handoff->before[i]; take <= last; take++) {
+			if (handoff->taken[take] > highest) {
+				highest = handoff->taken[take];
+			}
+		}
+		if (highest < handoff->peak[i]) {
+			lost++;
+		}
+	}
+	printf("%6zu %8u %8u %8u\n", frames, HANDOFF_PERIODS, takes, lost);
+	return lost;
+}
+
+static int bench_peak_handoff(void) {
+	struct handoff_t handoff;
+	float signal[1024 + HANDOFF_MAX_FRAMES];
+	float gain[1024];
+	size_t frames;
+	size_t i;
+	int failures = 0;
+	for (i = 0; i < 1024 + HANDOFF_MAX_FRAMES; i++) {
+		signal[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+	}
+	for (i = 0; i < 1024; i++) {
+		gain[i] = powf(10.0f, -3.0f * rand() / RAND_MAX);
+	}
+	handoff.signal = signal;
+	handoff.gain = gain;
+	handoff.peak = (float*) malloc(HANDOFF_PERIODS * sizeof(float));
+	handoff.before = (unsigned int*) malloc(
+			HANDOFF_PERIODS * sizeof(unsigned int));
+	handoff.after = (unsigned int*) malloc(
+			HANDOFF_PERIODS * sizeof(unsigned int));
+	// at most a take for every period published and a last one
+	handoff.taken = (float*) malloc((HANDOFF_PERIODS + 1) * sizeof(float));
+	printf("peak handoff, a display take after every period or two\n");
+	printf("%6s %8s %8s %8s\n", "frames", "periods", "takes", "lost");
+	for (frames = HANDOFF_MIN_FRAMES; frames <= HANDOFF_MAX_FRAMES; frames *= 2) {
+		if (run_handoff(&handoff, frames)) {
+			fprintf(stderr, "peaks were lost between publish and take at %zu frames\n",
+					frames);
+			failures++;
+		}
+	}
+	printf("\n");
+	free(handoff.peak);
+	free(handoff.before);
+	free(handoff.after);
+	free(handoff.taken);
+	return failures;
+}
+
+/*
+ * TRUE PEAK
+ *
+ * The cost of the true peak kernels for one channel's period, and their
+ * readings of signals whose peak falls between the samples.  EBU Tech 3341
+ * allows a true peak meter to read from 0.4 dB under to 0.2 dB over.
+ */
+#define TRUE_PEAK_RATE 48000
+#define TRUE_PEAK_SIGNAL_LEN 4800
+/* the period the true peak meter is checked at */
+#define TRUE_PEAK_PERIOD 256
+#define TRUE_PEAK_UNDER_DB -0.4
+#define TRUE_PEAK_OVER_DB 0.2
+
+struct true_peak_signal_t {
+	const char *name;
+	/* a sine of this frequency, amplitude and phase, or an impulse */
+	double frequency;
+	double amplitude;
+	double phase;
+};
+
+static const struct true_peak_signal_t true_peak_signals[] = {
+	{ "997 Hz 0 dBFS", 997.0, 1.0, 0.0 },
+	{ "12 kHz 0 dBFS 45 deg", 12000.0, 1.0, M_PI / 4.0 },
+	{ "16 kHz -6 dBFS", 16000.0, 0.5, 0.0 },
+	{ "6 kHz -3 dBFS 22.5 deg", 6000.0, M_SQRT1_2, M_PI / 8.0 },
+	{ "20 kHz 0 dBFS 15 deg", 20000.0, 1.0, M_PI / 12.0 },
+	{ "impulse 0 dBFS", 0.0, 1.0, 0.0 },
+	{ NULL, 0.0, 0.0, 0.0 }
+};
+
+/* Fill a signal with its history, returns its sample peak */
+static float make_true_peak_signal(const struct true_peak_signal_t *test,
+		float *buf) {
+	float peak = 0.0f;
+	int i;
+	for (i = -TRUE_PEAK_HISTORY; i < TRUE_PEAK_SIGNAL_LEN; i++) {
+		float s;
+		if (test->frequency > 0.0) {
+			s = test->amplitude
+					* sin(2.0 * M_PI * test->frequency * i / TRUE_PEAK_RATE
+							+ test->phase);
+		} else {
+			s = i == TRUE_PEAK_SIGNAL_LEN / 2 ? test->amplitude : 0.0f;
+		}
+		buf[i] = s;
+		peak = fabsf(s) > peak ? fabsf(s) : peak;
+	}
+	return peak;
+}
+
+/* The true peak meter's reading of a signal metered in periods */
+static float true_peak_meter_reading(const float *buf) {
+	struct ballistics_t meter;
+	float reading = 0.0f;
+	unsigned int offset;
+	if (ballistics_init(&meter, 1, TRUE_PEAK_RATE, DEFAULT_RMS_WINDOW)) {
+		return 0.0f;
+	}
+	ballistics_want(&meter, 0, METER_MODE_BIT(METER_TRUE_PEAK));
+	for (offset = 0; offset < TRUE_PEAK_SIGNAL_LEN; offset += TRUE_PEAK_PERIOD) {
+		unsigned int n = TRUE_PEAK_SIGNAL_LEN - offset;
+		n = n < TRUE_PEAK_PERIOD ? n : TRUE_PEAK_PERIOD;
+		ballistics_begin_period(&meter, n);
+		ballistics_channel(&meter, 0, buf + offset, n);
+		float peak = ballistics_take_true_peak(&meter, 0);
+		// the filter starts from silence, so its first period rings
+		if (offset > 0) {
+			reading = peak > reading ? peak : reading;
+		}
+	}
+	ballistics_free(&meter);
+	return reading;
+}
+
+static int bench_true_peak(void) {
+	const struct peak_kernel_info *info;
+	const struct true_peak_signal_t *test;
+	size_t frames;
+	size_t i;
+	int failures = 0;
+	float *signal = (float*) malloc(
+			(TRUE_PEAK_HISTORY + BENCH_MAX_FRAMES + 8) * sizeof(float));
+	float *buf = signal + TRUE_PEAK_HISTORY;
+
+	for (i = 0; i < TRUE_PEAK_HISTORY + BENCH_MAX_FRAMES + 8; i++) {
+		signal[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+	}
+	printf("true peak kernels, ns per channel period (ns per sample)\n");
+	printf("%6s", "frames");
+	for (info = peak_kernels; info->name; info++) {
+		if (info->supported()) {
+			printf(" %16s", info->name);
+		}
+	}
+	printf("\n");
+	for (frames = BENCH_MIN_FRAMES; frames <= BENCH_MAX_FRAMES; frames *= 2) {
+		printf("%6zu", frames);
+		for (info = peak_kernels; info->name; info++) {
+			if (info->supported()) {
+				double ns = time_kernel(info->true_peak, buf, frames);
+				printf(" %9.1f (%4.2f)", ns, ns / frames);
+			}
+		}
+		printf("\n");
+	}
+	free(signal);
+
+	signal = (float*) malloc(
+			(TRUE_PEAK_HISTORY + TRUE_PEAK_SIGNAL_LEN) * sizeof(float));
+	buf = signal + TRUE_PEAK_HISTORY;
+	printf("true peak readings in dB, allowed %.1f to +%.1f\n",
+			TRUE_PEAK_UNDER_DB, TRUE_PEAK_OVER_DB);
+	printf("%-24s %8s %8s", "signal", "expected", "sample");
+	for (info = peak_kernels; info->name; info++) {
+		if (info->supported()) {
+			printf(" %8s", info->name);
+		}
+	}
+	printf("\n");
+	for (test = true_peak_signals; test->name; test++) {
+		double expected = 20.0 * log10(test->amplitude);
+		float sample_peak = make_true_peak_signal(test, buf);
+		printf("%-24s %8.2f %8.2f", test->name, expected,
+				20.0 * log10(sample_peak));
+		for (info = peak_kernels; info->name; info++) {
+			if (!info->supported()) {
+				continue;
+			}
+			double reading = 20.0 * log10(
+					info->true_peak(buf, TRUE_PEAK_SIGNAL_LEN));
+			printf(" %8.2f", reading);
+			if (reading < expected + TRUE_PEAK_UNDER_DB
+					|| reading > expected + TRUE_PEAK_OVER_DB) {
+				fprintf(stderr, "%s true peak kernel reads %s as %.2f dB\n",
+						info->name, test->name, reading);
+				failures++;
+			}
+		}
+		printf("\n");
+	}
+	// the meter, unlike the kernels, never reads under the sample peak
+	printf("%-24s %8s %8s %8s\n", "true peak meter", "expected", "sample",
+			"reading");
+	for (test = true_peak_signals; test->name; test++) {
+		double expected = 20.0 * log10(test->amplitude);
+		float sample_peak = make_true_peak_signal(test, buf);
+		float meter_peak = true_peak_meter_reading(buf);
+		double reading = 20.0 * log10(meter_peak);
+		printf("%-24s %8.2f %8.2f %8.2f\n", test->name, expected,
+				20.0 * log10(sample_peak), reading);
+		if (meter_peak < sample_peak || reading < expected + TRUE_PEAK_UNDER_DB
+				|| reading > expected + TRUE_PEAK_OVER_DB) {
+			fprintf(stderr, "true peak meter reads %s as %.2f dB\n",
+					test->name, reading);
+			failures++;
+		}
+	}
+	// a NaN sample must be passed over by every kernel, as by the scalar one
+	make_true_peak_signal(true_peak_signals, buf);
+	buf[TRUE_PEAK_SIGNAL_LEN / 2] = NAN;
+	buf[TRUE_PEAK_SIGNAL_LEN - 1] = NAN;
+	for (info = peak_kernels; info->name; info++) {
+		if (info->supported()
+				&& isnan(info->true_peak(buf, TRUE_PEAK_SIGNAL_LEN))) {
+			fprintf(stderr, "%s true peak kernel passes a NaN sample through\n",
+					info->name);
+			failures++;
+		}
+	}
+	printf("\n");
+	free(signal);
+	return failures;
+}
+
+/*
+ * PPM
+ *
+ * IEC 60268-10 has a type I PPM read 1 dB under the steady level of a 5 kHz
+ * tone for a burst of 10 ms, give or take 0.5 dB.  The burst starts part way
+ * through a period, and the reading must not change with the period.
+ */
+#define PPM_RATE 48000
+#define PPM_BURST_SECONDS 0.010
+#define PPM_BURST_DB -1.0
+#define PPM_BURST_TOLERANCE_DB 0.5
+/* the burst starts this long into the signal, and the signal goes on as long */
+#define PPM_BURST_START 4817
+
+static const unsigned int ppm_periods[] = { 16, 64, 256, 1024, 4096, 0 };
+
+/* The highest PPM reading of a tone burst metered in periods of period frames */
+static float ppm_burst_reading(const float *signal, unsigned int len,
+		unsigned int period) {
+	struct ballistics_t meter;
+	float reading = 0.0f;
+	unsigned int offset;
+	if (ballistics_init(&meter, 1, PPM_RATE, DEFAULT_RMS_WINDOW)) {
+		return 0.0f;
+	}
+	ballistics_want(&meter, 0, METER_MODE_BIT(METER_PPM));
+	for (offset = 0; offset + period <= len; offset += period) {
+		ballistics_begin_period(&meter, period);
+		ballistics_channel(&meter, 0, signal + offset, period);
+		float level = ballistics_level(&meter, 0, METER_PPM);
+		reading = level > reading ? level : reading;
+	}
+	ballistics_free(&meter);
+	return reading;
+}
+
+static int bench_ppm(void) {
+	unsigned int burst = (unsigned int) (PPM_BURST_SECONDS * PPM_RATE);
+	unsigned int len = 2 * PPM_BURST_START + burst;
+	float *signal = (float*) calloc(len, sizeof(float));
+	int failures = 0;
+	unsigned int i;
+	for (i = 0; i < burst; i++) {
+		signal[PPM_BURST_START + i] = sin(2.0 * M_PI * 5000.0 * i / PPM_RATE);
+	}
+	// the burst's sample peak, as the steady tone would read
+	double steady = 20.0 * log10(peak_abs_max(signal, len));
+	printf("PPM reading of a %.0f ms 5 kHz burst in dB, allowed %.1f +/- %.1f\n",
+			1000.0 * PPM_BURST_SECONDS, PPM_BURST_DB, PPM_BURST_TOLERANCE_DB);
+	printf("%6s %8s\n", "period", "reading");
+	for (i = 0; ppm_periods[i]; i++) {
+		double reading = 20.0 * log10(
+				ppm_burst_reading(signal, len, ppm_periods[i])) - steady;
+		printf("%6u %8.2f\n", ppm_periods[i], reading);
+		if (fabs(reading - PPM_BURST_DB) > PPM_BURST_TOLERANCE_DB) {
+			fprintf(stderr, "PPM reads a 10 ms burst as %.2f dB at a period of %u\n",
+					reading, ppm_periods[i]);
+			failures++;
+		}
+	}
+	printf("\n");
+	free(signal);
+	return failures;
+}
+
+/*
+ * LEVEL TRACES
+ *
+ * A trace has a line for each display frame with the peak of each channel
+ * taken in that frame.  The meter writes one with -T.
+ */
+struct trace_t {
+	unsigned int channels;
+	unsigned int frames;
+	float *peaks;
+};
+
+static int read_trace(const char *trace_file, struct trace_t *trace) {
+	FILE *f = fopen(trace_file, "r");
+	char line[4096];
+	unsigned int allocated = 0;
+	if (f == NULL) {
+		perror(trace_file);
+		return -1;
+	}
+	memset(trace, 0, sizeof(struct trace_t));
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line;
+		char *end;
+		unsigned int channel = 0;
+		float peaks[MAX_CHANNELS];
+		while (channel < MAX_CHANNELS) {
+			peaks[channel] = strtof(p, &end);
+			if (end == p) {
+				break;
+			}
+			p = end;
+			channel++;
+		}
+		if (channel == 0) {
+			continue;
+		}
+		if (trace->channels == 0) {
+			trace->channels = channel;
+		}
+		if (trace->frames == allocated) {
+			allocated = allocated ? allocated * 2 : 1024;
+			trace->peaks = realloc(trace->peaks,
+					allocated * trace->channels * sizeof(float));
+		}
+		for (channel = 0; channel < trace->channels; channel++) {
+			trace->peaks[trace->frames * trace->channels + channel] = peaks[channel];
+		}
+		trace->frames++;
+	}
+	fclose(f);
+	return trace->frames ? 0 : -1;
+}
+
+/*
+ * A minute of two channels of programme: a slowly wandering level with
+ * transients, and quiet passages where the level barely moves.
+ */
+static void generate_trace(struct trace_t *trace, int update_rate) {
+	unsigned int frame;
+	unsigned int channel;
+	float level[2] = { 0.1f, 0.1f };
+	trace->channels = 2;
+	trace->frames = 60 * update_rate;
+	trace->peaks = malloc(trace->frames * trace->channels * sizeof(float));
+	srand(2);
+	for (frame = 0; frame < trace->frames; frame++) {
+		int quiet = (frame / (10 * update_rate)) % 3 == 2;
+		for (channel = 0; channel < trace->channels; channel++) {
+			float step = quiet ? 0.01f : 0.25f;
+			level[channel] *= powf(10.0f, step * (2.0f * rand() / RAND_MAX - 1.0f));
+			if (level[channel] > 1.0f) {
+				level[channel] = 1.0f;
+			} else if (level[channel] < 0.001f) {
+				level[channel] = 0.001f;
+			}
+			float peak = level[channel];
+			if (!quiet && rand() % 16 == 0) {
+				peak = peak * 4.0f > 1.0f ? 1.0f : peak * 4.0f;
+			}
+			trace->peaks[frame * trace->channels + channel] = peak;
+		}
+	}
+}
+
+/* Replay the trace through the display, returns the bytes sent to the LCD */
+static unsigned long replay_trace(const struct trace_t *trace,
+		int update_rate, int differential) {
+	struct display_info_t display_info;
+	char frame_buffer[LCD_FRAME_SIZE];
+	unsigned long bytes = 0;
+	unsigned int frame;
+	unsigned int channel;
+
+	memset(&display_info, 0, sizeof(struct display_info_t));
+	display_info.update_rate = update_rate;
+	display_info.bias = 1.0f;
+	display_info.channels_installed = trace->channels;
+	display_info.channels_displaying = trace->channels < 2 ? trace->channels : 2;
+
+	channel_store_init(&channel_store, trace->channels);
+	lcd_screen_init(&lcd_screen);
+	lcd_screen.differential = differential;
+	for (frame = 0; frame < trace->frames; frame++) {
+		for (channel = 0; channel < trace->channels; channel++) {
+			publish_peak(&channel_store.peak[channel],
+					trace->peaks[frame * trace->channels + channel]);
+		}
+		display_info.frame_ns = frame * 1000000000ull / update_rate;
+		update_display(&display_info);
+		bytes += lcd_screen_compose(&lcd_screen, frame_buffer,
+				sizeof(frame_buffer));
+	}
+	channel_store_free(&channel_store);
+	return bytes;
+}
+
+/* The deflections checked, at the reference levels of -r, in dB */
+static const float meter_scale_references[] = { 0.0f, -18.0f, 4.0f, 12.0f };
+#define METER_SCALE_SWEEP 100000
+
+/*
+ * Count the peaks the table of a meter deflects differently from log10f and
+ * iec_scale(): a sweep of levels from -100 to +12 dB, and every threshold
+ * with the floats either side of it.
+ */
+static int check_meter_scale(int size, float reference) {
+	struct meter_scale_t scale;
+	float bias = powf(10.0f, reference * -0.05f);
+	int cell = size / CONSOLE_WIDTH;
+	int mismatches = 0;
+	int worst = 0;
+	int i;
+	if (meter_scale_init(&scale, size, bias)) {
+		fprintf(stderr, "Cannot build the meter scale\n");
+		return 1;
+	}
+	for (i = 0; i < METER_SCALE_SWEEP + 3 * size; i++) {
+		float peak;
+		if (i < METER_SCALE_SWEEP) {
+			peak = powf(10.0f, (-100.0f + 112.0f * i / METER_SCALE_SWEEP) / 20.0f)
+					/ bias;
+		} else {
+			int k = (i - METER_SCALE_SWEEP) / 3;
+			int side = (i - METER_SCALE_SWEEP) % 3;
+			peak = scale.threshold[k];
+			if (side == 1) {
+				peak = nextafterf(peak, 0.0f);
+			} else if (side == 2) {
+				peak = nextafterf(peak, INFINITY);
+			}
+		}
+		int expected = iec_scale(20.0f * log10f(peak * bias), size);
+		int table = meter_scale_deflection(&scale, peak);
+		int error = abs(table - expected);
+		if (error) {
+			mismatches++;
+			worst = error > worst ? error : worst;
+		}
+	}
+	meter_scale_free(&scale);
+	printf("%6d %10.1f %10d %10d\n", size, reference, mismatches, worst);
+	if (mismatches) {
+		fprintf(stderr,
+				"meter scale table of %d steps at %.1f dB disagrees with iec_scale"
+				" at %d peaks, by up to %d steps (%s a cell)\n", size, reference,
+				mismatches, worst, worst > cell ? "more than" : "within");
+	}
+	return mismatches != 0;
+}
+
+/* The scale lookup of update_display against the log10f and iec_scale() it replaced */
+static int bench_meter_scale(void) {
+	const int lookups = 4 * 1024 * 1024;
+	const int sizes[] = { CONSOLE_WIDTH, CONSOLE_WIDTH * LCD_CELL_COLUMNS };
+	struct meter_scale_t scale;
+	float peaks[1024];
+	int failures = 0;
+	int sum = 0;
+	size_t i;
+	size_t j;
+	meter_scale_init(&scale, CONSOLE_WIDTH, 1.0f);
+	for (i = 0; i < 1024; i++) {
+		peaks[i] = powf(10.0f, -4.0f * rand() / RAND_MAX);
+	}
+	double start = now_ns();
+	for (i = 0; i < (size_t) lookups; i++) {
+		sum += iec_scale(20.0f * log10f(peaks[i & 1023]), CONSOLE_WIDTH);
+	}
+	double formula = (now_ns() - start) / lookups;
+	start = now_ns();
+	for (i = 0; i < (size_t) lookups; i++) {
+		sum += meter_scale_deflection(&scale, peaks[i & 1023]);
+	}
+	double table = (now_ns() - start) / lookups;
+	bench_sink = sum;
+	meter_scale_free(&scale);
+	printf("meter scale, ns per peak: log10f and iec_scale %.1f, table %.1f\n",
+			formula, table);
+	printf("%6s %10s %10s %10s\n", "steps", "reference", "mismatches",
+			"worst");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (j = 0; j < sizeof(meter_scale_references)
+				/ sizeof(meter_scale_references[0]); j++) {
+			failures += check_meter_scale(sizes[i], meter_scale_references[j]);
+		}
+	}
+	printf("\n");
+	return failures;
+}
+
+static int bench_display(const char *trace_file, int update_rate) {
+	struct trace_t trace;
+	if (trace_file) {
+		if (read_trace(trace_file, &trace)) {
+			fprintf(stderr, "Cannot read a level trace from %s\n", trace_file);
+			return 1;
+		}
+	} else {
+		generate_trace(&trace, update_rate);
+	}
+	printf("display, %u frames of %u channels at %d frames per second from %s\n",
+			trace.frames, trace.channels, update_rate,
+			trace_file ? trace_file : "a generated trace");
+	unsigned long full = replay_trace(&trace, update_rate, 0);
+	unsigned long differential = replay_trace(&trace, update_rate, 1);
+	double seconds = (double) trace.frames / update_rate;
+	printf("%14s %12s %12s\n", "", "bytes/frame", "bytes/s");
+	printf("%14s %12.1f %12.1f\n", "full rows", (double) full / trace.frames,
+			full / seconds);
+	printf("%14s %12.1f %12.1f\n\n", "differential",
+			(double) differential / trace.frames, differential / seconds);
+	free(trace.peaks);
+	return 0;
+}
+
+/*
+ * SIMULATED ENGINE
+ *
+ * Stands in for the JACK server: calls the process callback with a period of
+ * synthetic signal on every channel as fast as it can, raises an xrun now and
+ * then, and runs the display frames in between on the null display.
+ */
+
+/* A sine per channel with a level that steps every half second, and noise */
+static float* make_signal(unsigned int channel, unsigned int sample_rate,
+		unsigned int period) {
+	float *signal = (float*) malloc(
+			(ENGINE_SIGNAL_LEN + period) * sizeof(float));
+	float w = 2.0f * (float) M_PI * 110.0f * (channel + 1) / sample_rate;
+	unsigned int i;
+	for (i = 0; i < ENGINE_SIGNAL_LEN + period; i++) {
+		unsigned int step = ((i % ENGINE_SIGNAL_LEN) / (sample_rate / 2)) % 4;
+		float level = powf(10.0f, -0.5f * step);
+		signal[i] = level * sinf(w * i)
+				+ 0.01f * (2.0f * rand() / RAND_MAX - 1.0f);
+	}
+	return signal;
+}
+
+static void bench_engine_run(const struct bench_config_t *config,
+		unsigned int channels, unsigned int period, unsigned int sample_rate) {
+	struct display_info_t display_info;
+	float *signal[MAX_CHANNELS];
+	float *buffers[MAX_CHANNELS];
+	unsigned int channel;
+	unsigned long p;
+	unsigned long periods = (unsigned long) ENGINE_SECONDS * sample_rate / period;
+	unsigned long xrun_periods = (unsigned long) ENGINE_XRUN_SECONDS
+			* sample_rate / period;
+	unsigned long frame_len = sample_rate / config->update_rate;
+	unsigned long samples = 0;
+	unsigned long next_frame = frame_len;
+	unsigned long frames = 0;
+	double process_ns = 0.0;
+	double worst_ns = 0.0;
+	double display_ns = 0.0;
+
+	memset(&display_info, 0, sizeof(struct display_info_t));
+	display_info.update_rate = config->update_rate;
+	display_info.bias = 1.0f;
+	display_info.recording = 1;
+	display_info.channels_installed = channels;
+	display_info.channels_displaying = channels < 2 ? channels : 2;
+	channel_store_init(&channel_store, channels);
+	ballistics_init(&ballistics, channels, sample_rate, DEFAULT_RMS_WINDOW);
+	lcd_screen_init(&lcd_screen);
+	memset(&lcd_stats, 0, sizeof(struct lcd_stats_t));
+	for (channel = 0; channel < channels; channel++) {
+		signal[channel] = make_signal(channel, sample_rate, period);
+	}
+
+	for (p = 0; p < periods; p++) {
+		unsigned long offset = (p * period) % ENGINE_SIGNAL_LEN;
+		for (channel = 0; channel < channels; channel++) {
+			buffers[channel] = signal[channel] + offset;
+		}
+		double start = now_ns();
+		meter_period(buffers, period);
+		double ns = now_ns() - start;
+		process_ns += ns;
+		if (ns > worst_ns) {
+			worst_ns = ns;
+		}
+		if (p % xrun_periods == xrun_periods - 1) {
+			increment_xrun(&display_info);
+		}
+		samples += period;
+		if (samples >= next_frame) {
+			next_frame += frame_len;
+			start = now_ns();
+			report_rt_events(&display_info);
+			display_info.frame_ns = (uint64_t) samples * 1000000000ull
+					/ sample_rate;
+			update_display(&display_info);
+			flush_lcd();
+			display_ns += now_ns() - start;
+			frames++;
+		}
+	}
+
+	double budget_ns = 1e9 * period / sample_rate;
+	printf("%8u %6u %6u %12.1f %8.2f %12.1f %7.3f%% %12.1f %10.1f\n",
+			channels, period, sample_rate, process_ns / periods,
+			process_ns / periods / (period * channels), worst_ns,
+			100.0 * worst_ns / budget_ns, frames ? display_ns / frames : 0.0,
+			(double) lcd_stats.bytes / ENGINE_SECONDS);
+
+	for (channel = 0; channel < channels; channel++) {
+		free(signal[channel]);
+	}
+	ballistics_free(&ballistics);
+	channel_store_free(&channel_store);
+}
+
+static int bench_engine(const struct bench_config_t *config) {
+	static const unsigned int default_channels[] = { 2, 32, 128, 0 };
+	static const unsigned int default_periods[] = { 16, 64, 256, 1024, 0 };
+	unsigned int one_channels[] = { config->channels, 0 };
+	unsigned int one_period[] = { config->period, 0 };
+	const unsigned int *channels = config->channels ? one_channels : default_channels;
+	const unsigned int *periods = config->period ? one_period : default_periods;
+	unsigned int sample_rate = config->sample_rate ? config->sample_rate :
+			ENGINE_DEFAULT_RATE;
+	int i, j;
+
+	struct display_t saved_display = lcd_display;
+	if (display_open(&lcd_display, display_backend_find("null"), NULL)) {
+		lcd_display = saved_display;
+		fprintf(stderr, "Cannot open the null display\n");
+		return 1;
+	}
+	printf("simulated engine, %d seconds of audio, %d display frames per second\n",
+			ENGINE_SECONDS, config->update_rate);
+	printf("%8s %6s %6s %12s %8s %12s %8s %12s %10s\n", "channels", "period",
+			"rate", "ns/period", "ns/samp", "worst ns", "budget",
+			"ns/display", "LCD B/s");
+	for (i = 0; channels[i]; i++) {
+		for (j = 0; periods[j]; j++) {
+			bench_engine_run(config, channels[i], periods[j], sample_rate);
+		}
+	}
+	printf("\n");
+	display_close(&lcd_display);
+	lcd_display = saved_display;
+	return 0;
+}
+
+static int run_benchmarks(const struct bench_config_t *config) {
+	int failures = bench_peak_kernels();
+	failures += bench_peak_handoff();
+	failures += bench_true_peak();
+	failures += bench_ppm();
+	failures += bench_meter_scale();
+	failures += bench_display(config->trace_file, config->update_rate);
+	failures += bench_engine(config);
+	return failures ? 1 : 0;
+}
+
+static void usage(const char *progname) {
+	fprintf(stderr,
+			"Usage %s [-T trace-file] [-f frequency] [-i inputs] [-P period] [-S rate]\n\n",
+			progname);
+	fprintf(stderr,
+			"Runs the benchmarks and self-checks of the metering code\n\n");
+	fprintf(stderr,
+			"       -T      replay the trace file recorded by cuimhne_jackmeter -T\n");
+	fprintf(stderr,
+			"       -f      the display updates per second (default 8)\n");
+	fprintf(stderr,
+			"       -i      the inputs of the simulated engine, from 1 to %d (default a range)\n",
+			MAX_CHANNELS);
+	fprintf(stderr,
+			"       -P, --period  the JACK period in frames, from 1 to %d (default a range)\n",
+			BENCH_MAX_PERIOD);
+	fprintf(stderr,
+			"       -S, --rate    the sample rate, from %d to %d (default 48000)\n",
+			BENCH_MIN_RATE, BENCH_MAX_RATE);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_config_t config;
+	struct display_info_t display_info;
+	int opt;
+	memset(&config, 0, sizeof(struct bench_config_t));
+	init_meter(&display_info);
+	config.update_rate = display_info.update_rate;
+
+	setbuf(stdout, NULL);
+	setbuf(stderr, NULL);
+
+	static const struct option long_options[] = {
+		{ "period", required_argument, NULL, 'P' },
+		{ "rate", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "T:f:i:P:S:h", long_options, NULL))
+			!= -1) {
+		switch (opt) {
+		case 'T':
+			config.trace_file = optarg;
+			break;
+		case 'f':
+			config.update_rate = atoi(optarg);
+			if (config.update_rate < 1) {
+				debug(1, "The update rate must be at least 1\n");
+				exit(1);
+			}
+			break;
+		case 'i':
+			config.channels = atoi(optarg);
+			if (config.channels < 1 || config.channels > MAX_CHANNELS) {
+				debug(1, "The number of inputs must be from 1 to %d\n",
+						MAX_CHANNELS);
+				exit(1);
+			}
+			break;
+		case 'P':
+			// a negative period wraps round past the most
+			config.period = atoi(optarg);
+			if (config.period < 1 || config.period > BENCH_MAX_PERIOD) {
+				debug(1, "The period must be from 1 to %d frames\n",
+						BENCH_MAX_PERIOD);
+				exit(1);
+			}
+			break;
+		case 'S':
+			config.sample_rate = atoi(optarg);
+			if (config.sample_rate < BENCH_MIN_RATE
+					|| config.sample_rate > BENCH_MAX_RATE) {
+				debug(1, "The sample rate must be from %d to %d\n",
+						BENCH_MIN_RATE, BENCH_MAX_RATE);
+				exit(1);
+			}
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (meter_scale_init(&meter_scale, CONSOLE_WIDTH, display_info.bias)) {
+		debug(1, "Cannot allocate the meter scale.\n");
+		exit(1);
+	}
+	return run_benchmarks(&config);
+}
@@ -0,0 +1,41 @@
+/*
+ bench.h
+ Benchmarks for the metering code of cuimhne_jackmeter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* the periods and sample rates -P and -S take for the simulated engine */
+#define BENCH_MAX_PERIOD 8192
+#define BENCH_MIN_RATE 8000
+#define BENCH_MAX_RATE 384000
+
+struct bench_config_t {
+	/* a level trace to replay through the display, or NULL for a generated one */
+	const char *trace_file;
+	/* display updates per second */
+	int update_rate;
+	/* the simulated JACK engine, 0 runs a range of each */
+	unsigned int channels;
+	unsigned int period;
+	unsigned int sample_rate;
+};
+
+#endif /* BENCH_H */
@@ -0,0 +1,159 @@
+/*
+ channel_store.c
+ Per channel state of the meter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "channel_store.h"
+
+#define CACHE_LINE 64
+
+/* allocate a cleared, cache line aligned array */
+static void* alloc_array(unsigned int count, size_t size) {
+	void *array = NULL;
+	size_t bytes = (count * size + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+	if (posix_memalign(&array, CACHE_LINE, bytes)) {
+		return NULL;
+	}
+	memset(array, 0, bytes);
+	return array;
+}
+
+int channel_store_init(struct channel_store_t *store, unsigned int count) {
+	memset(store, 0, sizeof(struct channel_store_t));
+	store->count = count;
+	store->input_port = alloc_array(count, sizeof(jack_port_t*));
+	store->peak = alloc_array(count, sizeof(_Atomic uint32_t));
+	store->overs = alloc_array(count, sizeof(_Atomic uint32_t));
+	store->clipped = alloc_array(count, sizeof(_Atomic uint32_t));
+	store->clip_run = alloc_array(count, sizeof(unsigned int));
+	store->last_peak = alloc_array(count, sizeof(float));
+	store->last_true_peak = alloc_array(count, sizeof(float));
+	store->max_peak = alloc_array(count, sizeof(float));
+	store->max_peak_time = alloc_array(count, sizeof(time_t));
+	store->level = alloc_array(count, sizeof(float));
+	store->mode = alloc_array(count, sizeof(int));
+	store->db = alloc_array(count, sizeof(float));
+	store->hold = alloc_array(count, sizeof(float));
+	store->hold_ns = alloc_array(count, sizeof(uint64_t));
+	if (!store->input_port || !store->peak || !store->overs
+			|| !store->clipped || !store->clip_run || !store->last_peak
+			|| !store->last_true_peak || !store->max_peak
+			|| !store->max_peak_time || !store->level || !store->mode || !store->db || !store->hold
+			|| !store->hold_ns) {
+		channel_store_free(store);
+		return -1;
+	}
+	return 0;
+}
+
+void channel_store_free(struct channel_store_t *store) {
+	free(store->input_port);
+	free(store->peak);
+	free(store->overs);
+	free(store->clipped);
+	free(store->clip_run);
+	free(store->last_peak);
+	free(store->last_true_peak);
+	free(store->max_peak);
+	free(store->max_peak_time);
+	free(store->level);
+	free(store->mode);
+	free(store->db);
+	free(store->hold);
+	free(store->hold_ns);
+	memset(store, 0, sizeof(struct channel_store_t));
+}
+
+/*
+ * The loop has no branches: a sample under full scale zeroes the run, and an
+ * over is counted when a run reaches OVER_RUN, so a long run is one over.
+ * The run carries on into the next period.
+ */
+void channel_store_count_clips(struct channel_store_t *store,
+		unsigned int channel, const float *in, jack_nframes_t nframes) {
+	unsigned int run = store->clip_run[channel];
+	uint32_t clipped = 0;
+	uint32_t overs = 0;
+	jack_nframes_t i;
+	for (i = 0; i < nframes; i++) {
+		const unsigned int full = fabsf(in[i]) >= CLIP_LEVEL;
+		run = (run + full) * full;
+		clipped += full;
+		overs += run == OVER_RUN;
+	}
+	store->clip_run[channel] = run;
+	if (clipped) {
+		atomic_fetch_add_explicit(&store->clipped[channel], clipped,
+				memory_order_relaxed);
+	}
+	if (overs) {
+		atomic_fetch_add_explicit(&store->overs[channel], overs,
+				memory_order_relaxed);
+	}
+}
+
+/*
+ * The falloff is worked out once for the time since the last frame and
+ * applied to every channel that was already falling then, so the pass over
+ * the channels is a compare and a multiply each.  A hold that ran out since
+ * the last frame falls only for the time since it ran out.
+ */
+void channel_store_update_holds(struct channel_store_t *store, uint64_t now_ns,
+		float hold_time, float falloff) {
+	uint64_t hold_ns = (uint64_t) (hold_time * 1e9f);
+	uint64_t since = now_ns > store->holds_updated_ns ?
+			now_ns - store->holds_updated_ns : 0;
+	float fall = 0.0f;
+	unsigned int channel;
+	if (falloff > 0.0f) {
+		fall = powf(10.0f, -falloff * since * 1e-9f / 20.0f);
+	}
+	store->holds_updated_ns = now_ns;
+	for (channel = 0; channel < store->count; channel++) {
+		float level = store->level[channel];
+		uint64_t held = now_ns - store->hold_ns[channel];
+		if (level >= store->hold[channel]) {
+			store->hold[channel] = level;
+			store->hold_ns[channel] = now_ns;
+		} else if (held > hold_ns) {
+			float channel_fall = fall;
+			if (falloff > 0.0f && held - hold_ns < since) {
+				channel_fall = powf(10.0f,
+						-falloff * (held - hold_ns) * 1e-9f / 20.0f);
+			}
+			float fallen = store->hold[channel] * channel_fall;
+			store->hold[channel] = fallen > level ? fallen : level;
+		}
+	}
+}
+
+void channel_store_reset_clips(struct channel_store_t *store) {
+	unsigned int channel;
+	for (channel = 0; channel < store->count; channel++) {
+		atomic_store_explicit(&store->overs[channel], 0, memory_order_relaxed);
+		atomic_store_explicit(&store->clipped[channel], 0,
+				memory_order_relaxed);
+		store->max_peak[channel] = 0.0f;
+		store->max_peak_time[channel] = 0;
+	}
+}
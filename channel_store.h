@@ -0,0 +1,159 @@
+/*
+ channel_store.h
+ Per channel state of the meter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef CHANNEL_STORE_H
+#define CHANNEL_STORE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <jack/jack.h>
+
+/* The most channels one meter can watch */
+#define MAX_CHANNELS 256
+#define DEFAULT_CHANNELS 2
+
+/* A sample at or above this is at full scale, 32767/32768 from 16 bits is */
+#define CLIP_LEVEL 0.9999f
+/* and this many full scale samples in a row are an over */
+#define OVER_RUN 3
+/* how long a peak hold stays before it falls, in seconds */
+#define DEFAULT_HOLD_TIME 1.6f
+
+/*
+ * The channels are kept as a structure of arrays so that each per period or
+ * per frame pass walks contiguous memory.  The arrays read by the JACK thread
+ * are allocated apart from the ones only the display uses, so display
+ * updates never share a cache line with the JACK thread's data.
+ */
+struct channel_store_t {
+	unsigned int count;
+
+	/* read by the JACK thread */
+	jack_port_t **input_port;
+	/* bits of the float peak seen since the last display frame, see publish_peak() */
+	_Atomic uint32_t *peak;
+	/* overs and full scale samples since they were reset */
+	_Atomic uint32_t *overs;
+	_Atomic uint32_t *clipped;
+	/* full scale samples at the end of the last period, JACK thread only */
+	unsigned int *clip_run;
+
+	/* used by the display only */
+	float *last_peak;
+	/* the true peak taken with the peak */
+	float *last_true_peak;
+	/* the highest peak since the clip counters were reset, and when */
+	float *max_peak;
+	time_t *max_peak_time;
+	/* the level the meter shows, in the channel's meter_mode_t */
+	float *level;
+	int *mode;
+	float *db;
+	/* the peak hold of the level, and the frame time it was last raised */
+	float *hold;
+	uint64_t *hold_ns;
+	/* the frame time of the last update of the holds */
+	uint64_t holds_updated_ns;
+};
+
+/**
+ * allocate and clear the arrays for count channels.
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int channel_store_init(struct channel_store_t *store, unsigned int count);
+
+void channel_store_free(struct channel_store_t *store);
+
+/**
+ * count the full scale samples and overs in a period of a channel, called by
+ * the JACK thread for periods with a full scale peak.
+ */
+void channel_store_count_clips(struct channel_store_t *store,
+		unsigned int channel, const float *in, jack_nframes_t nframes);
+
+/**
+ * move the peak holds of every channel to the levels of a display frame.
+ * A level at or above its hold raises it, and a hold not raised for
+ * hold_time falls towards the level at falloff, so the holds keep their
+ * time however the frames are spaced.
+ * @param now_ns the time of the frame
+ * @param falloff dB per second, 0 to drop to the level at once
+ */
+void channel_store_update_holds(struct channel_store_t *store, uint64_t now_ns,
+		float hold_time, float falloff);
+
+/* Zero the clip counters and max peaks, called by the display */
+void channel_store_reset_clips(struct channel_store_t *store);
+
+/*
+ * PEAK HANDOFF
+ *
+ * The peak of a channel is passed from the JACK thread to the display as the
+ * bit pattern of a non-negative float, for which the integer order is the
+ * float order.  The JACK thread raises it with an atomic max once per period
+ * and the display takes it with an atomic exchange against zero, so neither
+ * side ever blocks and no peak published between two frames is lost.
+ */
+static inline uint32_t peak_to_bits(float peak) {
+	union {
+		float f;
+		uint32_t u;
+	} v;
+	v.f = peak;
+	return v.u;
+}
+
+static inline float bits_to_peak(uint32_t bits) {
+	union {
+		float f;
+		uint32_t u;
+	} v;
+	v.u = bits;
+	return v.f;
+}
+
+/*
+ * Raise the published peak to at least peak.  The compare-and-swap only fails
+ * when the display took the peak in the meantime, which happens at most once
+ * per frame, so the loop is bounded.
+ */
+static inline void publish_peak(_Atomic uint32_t *slot, float peak) {
+	uint32_t bits = peak_to_bits(peak);
+	uint32_t current = atomic_load_explicit(slot, memory_order_relaxed);
+	while (bits > current
+			&& !atomic_compare_exchange_weak_explicit(slot, &current, bits,
+					memory_order_release, memory_order_relaxed)) {
+	}
+}
+
+/* Take the peak published since the last call, leaving zero in its place */
+static inline float take_peak(_Atomic uint32_t *slot) {
+	return bits_to_peak(
+			atomic_exchange_explicit(slot, 0, memory_order_acquire));
+}
+
+/* The peak published since the last take, leaving it in place */
+static inline float peek_peak(_Atomic uint32_t *slot) {
+	return bits_to_peak(atomic_load_explicit(slot, memory_order_relaxed));
+}
+
+#endif /* CHANNEL_STORE_H */
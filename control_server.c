@@ -0,0 +1,340 @@
+/*
+ control_server.c
+ Unix domain socket for controlling and querying the meter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+/* for accept4 */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control_server.h"
+#include "meter_frame.h"
+
+static void client_reset(struct control_client_t *client) {
+	client->fd = -1;
+	client->in_len = 0;
+	client->discarding = 0;
+	client->out_start = 0;
+	client->out_len = 0;
+	client->overflow = 0;
+	client->rate = 0;
+	client->phase = 0;
+	client->dropped = 0;
+}
+
+static void client_close(struct control_client_t *client) {
+	close(client->fd);
+	client_reset(client);
+}
+
+void control_server_init(struct control_server_t *server) {
+	int i;
+	memset(server, 0, sizeof(struct control_server_t));
+	server->fd = -1;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		client_reset(&server->client[i]);
+	}
+}
+
+int control_server_open(struct control_server_t *server, const char *path,
+		int (*execute)(struct control_client_t *client, char *line,
+				void *context), void *context) {
+	struct sockaddr_un address;
+	control_server_init(server);
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	server->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0);
+	if (server->fd < 0) {
+		return -1;
+	}
+	unlink(path);
+	if (bind(server->fd, (struct sockaddr*) &address, sizeof(address))
+			|| listen(server->fd, CONTROL_MAX_CLIENTS)) {
+		close(server->fd);
+		server->fd = -1;
+		return -1;
+	}
+	server->path = strdup(path);
+	server->execute = execute;
+	server->context = context;
+	return 0;
+}
+
+/* Send as much of the queued replies as the socket takes */
+static int client_flush(struct control_client_t *client) {
+	while (client->out_len > 0) {
+		ssize_t sent = send(client->fd, &client->out[client->out_start],
+				client->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		client->out_start += sent;
+		client->out_len -= sent;
+	}
+	client->out_start = 0;
+	return 0;
+}
+
+void control_server_close(struct control_server_t *server) {
+	int i;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (server->client[i].fd >= 0) {
+			client_flush(&server->client[i]);
+			client_close(&server->client[i]);
+		}
+	}
+	if (server->fd >= 0) {
+		close(server->fd);
+		server->fd = -1;
+	}
+	if (server->path) {
+		unlink(server->path);
+		free(server->path);
+		server->path = NULL;
+	}
+}
+
+int control_client_printf(struct control_client_t *client, const char *fmt,
+		...) {
+	va_list args;
+	if (client->overflow) {
+		return -1;
+	}
+	if (client->out_start > 0) {
+		memmove(client->out, &client->out[client->out_start], client->out_len);
+		client->out_start = 0;
+	}
+	// a subscriber's reply goes behind a header that tells it from the frames
+	int header = client->rate ? sizeof(struct meter_reply_header_t) : 0;
+	int room = CONTROL_OUT_SIZE - client->out_len - header;
+	char *text = &client->out[client->out_len + header];
+	va_start(args, fmt);
+	int len = room > 0 ? vsnprintf(text, room, fmt, args) : -1;
+	va_end(args);
+	if (len < 0 || len >= room) {
+		client->overflow = 1;
+		return -1;
+	}
+	if (header) {
+		struct meter_reply_header_t reply;
+		memcpy(reply.magic, METER_REPLY_MAGIC, sizeof(reply.magic));
+		reply.size = header + len;
+		memcpy(&client->out[client->out_len], &reply, header);
+	}
+	client->out_len += header + len;
+	return 0;
+}
+
+void control_client_subscribe(struct control_client_t *client, int rate) {
+	client->rate = rate;
+	client->phase = 0;
+	client->dropped = 0;
+}
+
+int control_server_subscribers(const struct control_server_t *server) {
+	int count = 0;
+	int i;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		count += server->client[i].fd >= 0 && server->client[i].rate;
+	}
+	return count;
+}
+
+void control_server_publish(struct control_server_t *server,
+		const void *frame, int len, int update_rate) {
+	int i;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		struct control_client_t *client = &server->client[i];
+		if (client->fd < 0 || !client->rate) {
+			continue;
+		}
+		client->phase += client->rate;
+		if (client->phase < update_rate) {
+			continue;
+		}
+		client->phase -= update_rate;
+		if (client->out_len) {
+			client->dropped++;
+			continue;
+		}
+		memcpy(client->out, frame, len);
+		client->out_start = 0;
+		client->out_len = len;
+		if (client_flush(client) < 0) {
+			client_close(client);
+		}
+	}
+}
+
+int control_server_pollfds(const struct control_server_t *server,
+		struct pollfd *fds) {
+	int count = 0;
+	int i;
+	if (server->fd < 0) {
+		return 0;
+	}
+	fds[count].fd = server->fd;
+	fds[count].events = POLLIN;
+	fds[count++].revents = 0;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		const struct control_client_t *client = &server->client[i];
+		if (client->fd >= 0) {
+			fds[count].fd = client->fd;
+			fds[count].events = client->out_len ? POLLIN | POLLOUT : POLLIN;
+			fds[count++].revents = 0;
+		}
+	}
+	return count;
+}
+
+static void accept_clients(struct control_server_t *server) {
+	int fd;
+	while ((fd = accept4(server->fd, NULL, NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		int i;
+		for (i = 0; i < CONTROL_MAX_CLIENTS && server->client[i].fd >= 0;
+				i++) {
+		}
+		if (i == CONTROL_MAX_CLIENTS) {
+			static const char full[] = "ERR too many clients\n";
+			send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(fd);
+			continue;
+		}
+		client_reset(&server->client[i]);
+		server->client[i].fd = fd;
+	}
+}
+
+/*
+ * Run the complete lines in the client's input, returns 0 if one asked the
+ * program to exit.  A line too long for the input is answered with an error
+ * and skipped up to its newline.
+ */
+static int run_lines(struct control_server_t *server,
+		struct control_client_t *client) {
+	int running = 1;
+	int start = 0;
+	int i;
+	for (i = 0; i < client->in_len; i++) {
+		if (client->in[i] != '\n') {
+			continue;
+		}
+		if (client->discarding) {
+			client->discarding = 0;
+		} else {
+			client->in[i] = '\0';
+			if (i > start && client->in[i - 1] == '\r') {
+				client->in[i - 1] = '\0';
+			}
+			if (!server->execute(client, &client->in[start], server->context)) {
+				running = 0;
+			}
+		}
+		start = i + 1;
+	}
+	client->in_len -= start;
+	memmove(client->in, &client->in[start], client->in_len);
+	if (client->in_len == CONTROL_LINE_SIZE) {
+		if (!client->discarding) {
+			control_client_printf(client, "ERR line too long\n");
+		}
+		client->discarding = 1;
+		client->in_len = 0;
+	}
+	return running;
+}
+
+/* Read and run what the client sent, returns -1 once it has gone */
+static int client_read(struct control_server_t *server,
+		struct control_client_t *client, int *running) {
+	for (;;) {
+		ssize_t len = recv(client->fd, &client->in[client->in_len],
+				CONTROL_LINE_SIZE - client->in_len, MSG_DONTWAIT);
+		if (len == 0) {
+			return -1;
+		}
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		client->in_len += len;
+		if (!run_lines(server, client)) {
+			*running = 0;
+		}
+	}
+}
+
+static struct control_client_t* find_client(struct control_server_t *server,
+		int fd) {
+	int i;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (server->client[i].fd == fd) {
+			return &server->client[i];
+		}
+	}
+	return NULL;
+}
+
+int control_server_handle(struct control_server_t *server,
+		const struct pollfd *fds, int count) {
+	int running = 1;
+	int i;
+	for (i = 1; i < count; i++) {
+		struct control_client_t *client = find_client(server, fds[i].fd);
+		if (client == NULL || !fds[i].revents) {
+			continue;
+		}
+		int gone = 0;
+		if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+			gone = client_read(server, client, &running) < 0;
+		}
+		// the replies are sent straight away, POLLOUT only finishes them, and
+		// a client that has shut down its side still gets what it asked for
+		if (client->out_len && client_flush(client) < 0) {
+			gone = 1;
+		}
+		if (gone || client->overflow) {
+			client_close(client);
+		}
+	}
+	if (count > 0 && (fds[0].revents & POLLIN)) {
+		accept_clients(server);
+	}
+	return running;
+}
@@ -0,0 +1,130 @@
+/*
+ control_server.h
+ Unix domain socket for controlling and querying the meter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <poll.h>
+
+#define CONTROL_MAX_CLIENTS 16
+/* the longest request line, with its newline */
+#define CONTROL_LINE_SIZE 256
+/* replies waiting for a client that is slow to read */
+#define CONTROL_OUT_SIZE 8192
+/* the most poll entries control_server_pollfds() fills */
+#define CONTROL_POLL_FDS (1 + CONTROL_MAX_CLIENTS)
+
+/*
+ * A client sends request lines and gets a reply line for each.  Replies are
+ * queued in out and sent as the socket takes them, so the main loop never
+ * blocks on a client; a client that lets out fill up is disconnected.
+ */
+struct control_client_t {
+	int fd;
+	char in[CONTROL_LINE_SIZE];
+	int in_len;
+	/* skipping the rest of a line that was too long */
+	int discarding;
+	char out[CONTROL_OUT_SIZE];
+	int out_start;
+	int out_len;
+	/* out filled up, the client is dropped */
+	int overflow;
+	/* the frames per second streamed to a subscriber, 0 when not subscribed */
+	int rate;
+	/* counts up by rate each display frame, a frame is due at update_rate */
+	int phase;
+	/* frames left out because the subscriber was behind */
+	unsigned long dropped;
+};
+
+struct control_server_t {
+	int fd;
+	char *path;
+	struct control_client_t client[CONTROL_MAX_CLIENTS];
+	/**
+	 * carries out a request line, without its newline, and queues the reply.
+	 * @return 0 if the program should exit
+	 */
+	int (*execute)(struct control_client_t *client, char *line, void *context);
+	void *context;
+};
+
+/* A server that is not listening, for control_server_close() */
+void control_server_init(struct control_server_t *server);
+
+/**
+ * listen on a socket at path, replacing any socket left there.
+ * @return 0 on success, -1 on failure
+ */
+int control_server_open(struct control_server_t *server, const char *path,
+		int (*execute)(struct control_client_t *client, char *line,
+				void *context), void *context);
+
+/* Send what replies the clients will take, then close and remove the socket */
+void control_server_close(struct control_server_t *server);
+
+/**
+ * fill in the poll entries of the socket and its clients.
+ * @param fds room for CONTROL_POLL_FDS entries
+ * @return the number of entries filled
+ */
+int control_server_pollfds(const struct control_server_t *server,
+		struct pollfd *fds);
+
+/**
+ * accept clients, run their requests and send their replies.
+ * @param fds the entries filled by control_server_pollfds() after the poll
+ * @return 0 if a request asked the program to exit
+ */
+int control_server_handle(struct control_server_t *server,
+		const struct pollfd *fds, int count);
+
+/**
+ * stream frames to a client from the next display frame.  The replies to its
+ * requests are framed from then on, see meter_frame.h.
+ * @param rate frames per second, at most the update rate, 0 to stop
+ */
+void control_client_subscribe(struct control_client_t *client, int rate);
+
+/* The number of clients subscribed */
+int control_server_subscribers(const struct control_server_t *server);
+
+/**
+ * queue a frame for each subscriber it is due for, called at every display
+ * frame.  A subscriber that has not taken its last frame yet misses this one
+ * rather than have frames pile up, so one that is slow to read never holds
+ * up the main loop or the other clients.
+ * @param len at most CONTROL_OUT_SIZE
+ * @param update_rate the display frames per second
+ */
+void control_server_publish(struct control_server_t *server,
+		const void *frame, int len, int update_rate);
+
+/**
+ * queue a reply for a client, in a reply frame for a subscriber.
+ * @return 0 on success, -1 if the client's replies are full and it will be
+ * disconnected
+ */
+int control_client_printf(struct control_client_t *client, const char *fmt,
+		...) __attribute__((format(printf, 2, 3)));
+
+#endif /* CONTROL_SERVER_H */
@@ -26,88 +26,144 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
 #include <jack/jack.h>
 #include <getopt.h>
 #include "config.h"
-
-int decay_len;
+#include "cuimhne_jackmeter.h"
+#include "meter_scale.h"
+#include "wav_file.h"
+#include "rt_log.h"
+#include "peak_kernel.h"
+#include "control_server.h"
+#include "meter_frame.h"
+#include "meter_shm.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "process_timing.h"
+#include "lcd_link.h"
+#include "frame_pacer.h"
+
+/* the peak holds stay for hold_time seconds, then fall at hold_falloff dB/s */
+float hold_time = DEFAULT_HOLD_TIME;
+float hold_falloff = 0.0f;
+float rms_window = DEFAULT_RMS_WINDOW;
 char *server_name = NULL;
 
 jack_client_t *client = NULL;
 jack_options_t options = JackNoStartServer;
 
 /* constants for lcd access */
-#define DEFAULT_DEVICE "/dev/lcd0"
-#define CONSOLE_WIDTH 20
-#define DISPLAY_WIDTH (CONSOLE_WIDTH+6)
-#define DISPLAY_SIZE(s) (s+6)
-
-#define ESC (char)0x1b
-#define CLEAR_TO_END '0'
-#define CLEAR_TO_BEGINNING '1'
-#define CLEAR_ALL '2'
-#define CLEAR_LINE "%c[%cK"
-#define CLEAR_SCREEN "%c[%cJ"
+#define STATUS_ROW 2
+#define FIRST_METER_ROW 3
 
 #define CMD_NO_DISPLAY '0'
 #define CMD_ONE_DISPLAY '1'
 #define CMD_TWO_DISPLAY '2'
+#define CMD_NEXT_CHANNELS '>'
+#define CMD_PREVIOUS_CHANNELS '<'
 #define CMD_STOP_RECORDING 'r'
 #define CMD_START_RECORDING 'R'
 #define CMD_EXIT 'x'
+#define CMD_STATS 's'
+#define CMD_NEXT_MODE 'm'
+#define CMD_RESET_LOUDNESS 'l'
+#define CMD_RESET_CLIPS 'c'
+#define CMD_REPORT_CLIPS 'p'
+#define CMD_REPORT_TIMING 't'
 #define DEFAULT_FIFO_NAME "/run/jack_meter"
 char *fifo_name = NULL;
-FILE *fifo = NULL;
+int fifo = -1;
+
+/* the control socket, only opened with -u */
+char *socket_name = NULL;
+struct control_server_t control_server;
+
+/* the shared memory snapshot, only published with --shm */
+char *shm_name = NULL;
+struct meter_shm_t meter_shm;
+
+/* the counters and timings served with --metrics */
+struct metrics_t metrics;
+char *metrics_address = NULL;
+struct metrics_server_t metrics_server;
+/*
+ * the process callback is only timed for the metrics when they are served,
+ * and not at all when process_timing times it for them
+ */
+int metrics_process = 0;
+
+/* every process callback, when built with --enable-process-timing */
+struct process_timing_t process_timing;
+
+/* signalled by the JACK xrun callback to wake the main loop */
+int wake_fd = -1;
 
 char *lcd_device = NULL;
+char *display_name = NULL;
+char *trace_name = NULL;
+FILE *trace = NULL;
 char peak_char = 'I';
 char meter_char = '#';
-int lcd;
+/*
+ * The steps of the bar in a character cell, LCD_CELL_COLUMNS when -b loads
+ * the bar glyphs, so the bar moves a pixel column at a time.
+ */
+int bar_steps = 1;
 
 /*
- * CHANNEL HANDLING
+ * Everything is drawn on lcd_screen, and flush_lcd() sends the characters
+ * that changed since the last refresh to the display with a single write.
+ * Once the writer thread is started the write is done there, so a slow LCD
+ * never holds up the main loop.  The display is an HD44780 unless -D picks
+ * another backend.
  */
-#define MAX_CHANNELS 2
-unsigned int channels = MAX_CHANNELS;
-struct channel_info_t {
-	int channel;
-	int dpeak;
-	int dtime;
-	float peak;
-	float last_peak;
-	float db;
-	jack_port_t *input_port;
-} channel_info[MAX_CHANNELS];
+struct display_t lcd_display;
+struct lcd_screen_t lcd_screen;
+struct lcd_stats_t lcd_stats;
+struct lcd_writer_t lcd_writer;
+/* with -a fewer frames are sent while the link to the LCD is saturated */
+struct lcd_link_t lcd_link;
+int adapt_link = 0;
+/* with -F the display is drawn at idle_rate while the levels are steady */
+struct frame_pacer_t frame_pacer;
+int idle_rate = 0;
 
 /*
- * Display handling
+ * CHANNEL HANDLING
  */
-struct display_info_t {
-	int recording;
-	int xrun_count;
-	int displaying;
-	time_t start_time;
-	time_t elapsed_seconds;
-	int channels_installed;
-	int channels_displaying;
-	int decibels_mode;
-	int update_rate;
-	float bias;
-	char xrun_len;
-};
+struct channel_store_t channel_store;
+/* RMS, VU and PPM levels, run alongside the peaks by the JACK thread */
+struct ballistics_t ballistics;
+/* the meter modes given with -M, the last is used for the remaining channels */
+int meter_modes[MAX_CHANNELS];
+unsigned int meter_mode_count = 0;
+/* programme loudness of all the inputs, only run for the loudness display */
+struct loudness_t loudness;
+/* the channel weights given with --weights */
+float *loudness_weights = NULL;
+unsigned int loudness_weight_count = 0;
+/* deflection of the bar meters, built once the reference level is known */
+struct meter_scale_t meter_scale;
 
 /* DEBUG */
 
-static unsigned int debug_level = 3;
+unsigned int debug_level = 3;
 
-static void debug(unsigned int level, const char *fmt, ...) {
+void debug(unsigned int level, const char *fmt, ...) {
 	va_list argp;
 	if (level <= debug_level) {
 		va_start(argp, fmt);
@@ -116,60 +172,74 @@ static void debug(unsigned int level, const char *fmt, ...) {
 	}
 }
 
-/* Callback called by JACK when audio is available.
- Stores value of peak sample */
-static int process_peak(jack_nframes_t nframes, void *arg) {
-	jack_default_audio_sample_t *in;
+/*
+ * The JACK callbacks may not call debug(), they record events in these logs
+ * instead.  Each callback runs on its own thread so each has its own log.
+ */
+#define RT_LOG_EVENTS 1024
+struct rt_log process_log;
+struct rt_log xrun_log;
+
+/*
+ * Meter one period of a channel.  Called from the JACK thread, and without
+ * JACK by analyse_file().
+ */
+static void meter_channel(unsigned int channel, const float *in,
+		jack_nframes_t nframes) {
+	// the ballistics take the peak of the period in their pass over it
+	const float peak = ballistics_channel(&ballistics, channel, in, nframes);
+	publish_peak(&channel_store.peak[channel], peak);
+	meter_shm_peak(&meter_shm, channel, peak);
+	// only a period with a full scale peak can hold a clipped sample
+	if (peak >= CLIP_LEVEL) {
+		channel_store_count_clips(&channel_store, channel, in, nframes);
+	} else {
+		channel_store.clip_run[channel] = 0;
+	}
+	rt_log_event(&process_log, 4, RT_EVENT_PEAK, channel, 0, peak);
+}
+
+void meter_period(float *const *buffers, jack_nframes_t nframes) {
 	unsigned int channel;
-	unsigned int i;
-	struct channel_info_t *info;
-	for (channel = 0; channel < channels; channel++) {
-		info = &channel_info[channel];
+	if (ballistics_begin_period(&ballistics, nframes)) {
+		rt_log_event(&process_log, 1, RT_EVENT_RMS_WINDOW, 0, nframes,
+				ballistics_rms_window(&ballistics));
+	}
+	for (channel = 0; channel < channel_store.count; channel++) {
 		/* just incase the port isn't registered yet */
-		if (info->input_port == NULL) {
-			debug(2, "Channel %d is not enabled\n", channel);
+		if (buffers[channel] == NULL) {
+			rt_log_event(&process_log, 2, RT_EVENT_PORT_DISABLED, channel, 0,
+					0.0f);
 		} else {
-			/* get the audio samples, and find the peak sample */
-			in = (jack_default_audio_sample_t*) jack_port_get_buffer(
-					info->input_port, nframes);
-			for (i = 0; i < nframes; i++) {
-				const float s = fabs(in[i]);
-				if (s > info->peak) {
-					debug(4, "Setting channel %d peak %f\n", channel, s);
-					info->peak = s;
-				}
-			}
+			meter_channel(channel, buffers[channel], nframes);
 		}
 	}
-	return 0;
+	loudness_period(&loudness, buffers, nframes);
+	meter_shm_publish(&meter_shm, nframes, ballistics.rms_level,
+			channel_store.overs, channel_store.clipped);
 }
 
-/*
- db: the signal stength in db
- width: the size of the meter
- */
-static int iec_scale(float db, int size) {
-	float def = 0.0f; /* Meter deflection %age */
-
-	if (db < -70.0f) {
-		def = 0.0f;
-	} else if (db < -60.0f) {
-		def = (db + 70.0f) * 0.25f;
-	} else if (db < -50.0f) {
-		def = (db + 60.0f) * 0.5f + 2.5f;
-	} else if (db < -40.0f) {
-		def = (db + 50.0f) * 0.75f + 7.5;
-	} else if (db < -30.0f) {
-		def = (db + 40.0f) * 1.5f + 15.0f;
-	} else if (db < -20.0f) {
-		def = (db + 30.0f) * 2.0f + 30.0f;
-	} else if (db < 0.0f) {
-		def = (db + 20.0f) * 2.5f + 50.0f;
-	} else {
-		def = 100.0f;
+/* Callback called by JACK when audio is available.
+ Stores value of peak sample */
+static int process_peak(jack_nframes_t nframes, void *arg) {
+	static jack_default_audio_sample_t *buffers[MAX_CHANNELS];
+	unsigned int channel;
+	uint64_t start = metrics_process ? metrics_now_ns() : 0;
+	uint64_t ticks = process_timing_now();
+	for (channel = 0; channel < channel_store.count; channel++) {
+		jack_port_t *port = channel_store.input_port[channel];
+		/* get the audio samples */
+		buffers[channel] = port == NULL ? NULL :
+				(jack_default_audio_sample_t*) jack_port_get_buffer(port,
+						nframes);
 	}
-
-	return (int) ((def / 100.0f) * ((float) size));
+	meter_period(buffers, nframes);
+	process_timing_record(&process_timing, ticks, process_timing_now(),
+			nframes);
+	if (metrics_process) {
+		metrics_time(&metrics.process, metrics_now_ns() - start);
+	}
+	return 0;
 }
 
 /* Connect the chosen port to ours */
@@ -185,7 +255,7 @@ static void connect_port(jack_client_t *client, char *port_name,
 	}
 	const char *fq_port_name = jack_port_name(port);
 	const char *fq_channel_name = jack_port_name(
-			channel_info[channel].input_port);
+			channel_store.input_port[channel]);
 	// Connect the port to our input port
 	debug(4, "Connecting '%s' to '%s' on channel %d\n", fq_port_name,
 			fq_channel_name, channel);
@@ -196,12 +266,17 @@ static void connect_port(jack_client_t *client, char *port_name,
 	}
 }
 
-/* Sleep for a fraction of a second */
-static int fsleep(float secs) {
-
-//#ifdef HAVE_USLEEP
-	return usleep(secs * 1000000);
-//#endif
+/* The names of the display backends for the usage */
+static const char* display_backend_names() {
+	static char names[80];
+	int i;
+	names[0] = '\0';
+	for (i = 0; display_backends[i]; i++) {
+		strncat(names, " ", sizeof(names) - strlen(names) - 1);
+		strncat(names, display_backends[i]->name,
+				sizeof(names) - strlen(names) - 1);
+	}
+	return names;
 }
 
 /* Display how to use this program */
@@ -212,136 +287,421 @@ static int usage(const char *progname) {
 			progname);
 	fprintf(stderr,
 			"where  -f      is how often to update the meter per second [8]\n");
+	fprintf(stderr,
+			"       -F, --idle-rate  update the meter this often while the levels are\n"
+			"               steady or no meter is shown, and at the -f rate on transients\n");
 	fprintf(stderr,
 			"       -d      is the debug level (0 = silent, 1=fatal, 2=error, 3=info, 4=debug, 5=trace)\n");
-	fprintf(stderr, "       -l      is the lcd to use (default /dev/lcd0)\n");
+	fprintf(stderr,
+			"       -D      the display backend to use, one of%s [hd44780]\n",
+			display_backend_names());
+	fprintf(stderr,
+			"       -l      is the lcd to use (default /dev/lcd0), or the file, - for\n"
+			"               stdout or |command for the file display\n");
 	fprintf(stderr,
 			"       -r      is the reference signal level for 0dB on the meter\n");
 	fprintf(stderr,
 			"       -s      is the [optional] name given the jack server when it was started\n");
+	fprintf(stderr,
+			"       -a      send fewer frames, down to 1 a second, while the LCD cannot keep up\n");
+	fprintf(stderr,
+			"       -b      draw the bars a pixel column at a time with glyphs loaded into the LCD\n");
 	fprintf(stderr,
 			"       -n      changes mode to output meter level as number in decibels\n");
 	fprintf(stderr,
 			"       -c      the name of the fifo (default /run/jack_meter)\n");
 	fprintf(stderr,
-			"       <port>  the port(s) to monitor (multiple ports are mixed)\n");
+			"       -u, --socket  the unix domain socket to take commands and queries on\n");
+	fprintf(stderr,
+			"       --shm   publish the levels in this POSIX shared memory object\n");
+	fprintf(stderr,
+			"       --metrics  serve OpenMetrics on this socket path or [host:]port\n");
+	fprintf(stderr,
+			"       -i      the number of input ports to create (default 2, at most %d)\n",
+			MAX_CHANNELS);
+	fprintf(stderr,
+			"       -M      the meter modes of the inputs in order, a comma separated list of\n"
+			"               peak, rms, vu, ppm or tp, the last is used for the remaining inputs [peak]\n");
+	fprintf(stderr,
+			"       --rms-window  the length of the RMS window in seconds [0.3]\n");
+	fprintf(stderr,
+			"       --hold  how long the peak hold stays in seconds [1.6]\n");
+	fprintf(stderr,
+			"       --falloff  how fast the peak hold then falls in dB/s, 0 drops it at once [0]\n");
+	fprintf(stderr,
+			"       -L      show the EBU R128 loudness of all the inputs instead of meters\n");
+	fprintf(stderr,
+			"       --weights  the loudness weights of the inputs in order, a comma separated list [1]\n");
+	fprintf(stderr,
+			"       -T      record the peak levels of each frame in a trace file\n");
+	fprintf(stderr,
+			"       -w, --file  meter a WAV file instead of JACK inputs and exit\n");
+	fprintf(stderr,
+			"       -o, --csv   write the levels of the -w file to this CSV file (default stdout)\n");
+	fprintf(stderr,
+			"       <port>  the port(s) to monitor, one per input\n");
 	exit(1);
 }
 
-void write_buffer_to_lcd(const char *const display_buffer, int len) {
+/* Returns 0 if the whole buffer was written, -1 otherwise */
+int write_buffer_to_lcd(const char *const display_buffer, int len) {
 	int expected = len * sizeof(char);
 	debug(5, "LCD: %d (%d) characters\n", len, expected);
-	int written = write(lcd, display_buffer, expected);
+	uint64_t start = metrics_now_ns();
+	int written = lcd_display.backend->flush(&lcd_display, display_buffer,
+			expected);
+	metrics_time(&metrics.lcd_write, metrics_now_ns() - start);
 	if (written != expected) {
 		debug(2, "*** only wrote %d of %d bytes\n", written, expected);
+		metrics_count(&metrics.lcd_short_writes, 1);
 	}
 	debug(4, "LCD: %d characters written\n", written);
+	lcd_stats.syscalls++;
+	lcd_stats.frame_syscalls++;
+	if (written > 0) {
+		metrics_size(&metrics.lcd_write_size, written);
+		metrics_count(&metrics.lcd_bytes, written);
+		lcd_stats.bytes += written;
+		lcd_stats.frame_bytes += written;
+	}
+	return written == expected ? 0 : -1;
 }
 
-/**
- * add codes to the front of the buffer to position the cursor to the first position on the line.
- * @param display_buffer the buffer to write 6 chars into.
- * @param row the row to position to
- */
-char* configure_buffer(char *display_buffer, char row) {
-	display_buffer[0] = ESC;
-	display_buffer[1] = '[';
-	display_buffer[2] = row;
-	display_buffer[3] = ';';
-	display_buffer[4] = '0';
-	display_buffer[5] = 'H';
-	return &display_buffer[6];
-}
-
-/**
- * set the column in the prefix used in the configure_buffer.  Position can be set from 0 to 9
- */
-void set_column_number(char *display_buffer, char column) {
-	display_buffer[4] = column;
+/* Compose a frame for the display, on the writer thread once it is started */
+static int compose_lcd_frame(struct lcd_screen_t *screen, char *out, int size) {
+	return lcd_display.backend->compose(&lcd_display, screen, out, size);
 }
 
-void clear_display(struct display_info_t *display_info) {
-	if (display_info->channels_displaying > 0) {
-		char display_buffer[DISPLAY_WIDTH];
-		char *text_buffer = configure_buffer(display_buffer, '3');
-		int size = 0;
-		if (display_info->channels_displaying == 2) {
-			size = sprintf(text_buffer, CLEAR_SCREEN, ESC, CLEAR_TO_END);
-		} else {
-			size = sprintf(text_buffer, CLEAR_LINE, ESC, CLEAR_ALL);
+/* Write a composed frame, on the writer thread once it is started */
+static int write_frame_to_lcd(const char *frame, int len) {
+	int error = write_buffer_to_lcd(frame, len);
+	lcd_stats.frames++;
+	debug(5, "LCD frame: %d syscalls %d bytes\n", lcd_stats.frame_syscalls,
+			lcd_stats.frame_bytes);
+	lcd_stats.frame_syscalls = 0;
+	lcd_stats.frame_bytes = 0;
+	return error;
+}
+
+/* Load the bar glyphs into the display, before the writer is started */
+static void load_bar_glyphs() {
+	char glyphs[LCD_GLYPHS_SIZE];
+	int len = lcd_display.backend->compose_glyphs(&lcd_display, glyphs,
+			LCD_GLYPHS_SIZE);
+	if (len > 0) {
+		write_buffer_to_lcd(glyphs, len);
+	}
+	// the rows are sent in full again with the glyphs they now show
+	lcd_screen_invalidate(&lcd_screen);
+}
+
+/* Send the changes drawn since the last flush to the LCD */
+void flush_lcd() {
+	if (lcd_writer.started) {
+		// a dropped frame keeps its drawn rows for the next flush
+		if (lcd_screen.drawn_rows
+				&& lcd_writer_post(&lcd_writer, &lcd_screen) == 0) {
+			lcd_screen.drawn_rows = 0;
 		}
-		write_buffer_to_lcd(display_buffer, DISPLAY_SIZE(size));
+		return;
+	}
+	char frame[DISPLAY_FRAME_SIZE];
+	int len = compose_lcd_frame(&lcd_screen, frame, DISPLAY_FRAME_SIZE);
+	// after a short write what the display shows is unknown
+	if (len > 0 && write_frame_to_lcd(frame, len)) {
+		lcd_screen_invalidate(&lcd_screen);
 	}
 }
 
-void display_time(struct display_info_t *display_info) {
-	uint minutes = display_info->elapsed_seconds / 60;
-	uint seconds = display_info->elapsed_seconds % 60;
+void report_lcd_stats(unsigned int level) {
+	unsigned long frames = lcd_stats.frames;
+	unsigned long syscalls = lcd_stats.syscalls;
+	unsigned long bytes = lcd_stats.bytes;
+	debug(level, "LCD: %lu frames, %lu syscalls, %lu bytes", frames, syscalls,
+			bytes);
+	if (frames) {
+		debug(level, " (%.2f syscalls, %.1f bytes per frame)",
+				(double) syscalls / frames, (double) bytes / frames);
+	}
+	if (lcd_writer.started || lcd_writer.dropped || lcd_writer.merged) {
+		debug(level, ", %lu frames dropped, %lu merged",
+				(unsigned long) lcd_writer.dropped,
+				(unsigned long) lcd_writer.merged);
+	}
+	debug(level, "\n");
+	if (metrics.lcd_write.count) {
+		debug(level, "LCD link: write p50 %.2f p99 %.2f max %.2f ms, %.0f bytes/s"
+				" while writing, %.0f%% busy", 1e-6
+				* metrics_quantile(&metrics.lcd_write, 0.5), 1e-6
+				* metrics_quantile(&metrics.lcd_write, 0.99), 1e-6
+				* atomic_load(&metrics.lcd_write.max_ns), lcd_link.throughput,
+				lcd_link.busy * 100.0);
+		if (lcd_link.adapt) {
+			debug(level, ", sending 1 frame in %d, slowed %lu times",
+					lcd_link.divisor, lcd_link.slowdowns);
+		}
+		debug(level, "\n");
+	}
+	if (frame_pacer.idle_divisor) {
+		debug(level, "Display: drawn at %d frames a second, back to %d by %lu"
+				" transients\n", frame_pacer_fast(&frame_pacer) ?
+				frame_pacer.update_rate :
+				frame_pacer.update_rate / frame_pacer.idle_divisor,
+				frame_pacer.update_rate, frame_pacer.wakes);
+	}
+}
 
-	char display_buffer[DISPLAY_WIDTH];
-	char time_pos = '1' + display_info->xrun_len;
-	char *text_buffer = configure_buffer(display_buffer, '2');
-	set_column_number(display_buffer, (char) time_pos);
-	int size = sprintf(text_buffer, "  T:%02i:%02i", minutes, seconds);
-	write_buffer_to_lcd(display_buffer, DISPLAY_SIZE(size));
+void report_process_timing(unsigned int level) {
+	struct process_timing_stats_t stats;
+	if (process_timing_stats(&process_timing, &stats)) {
+		debug(level, "Process timing is not built in\n");
+		return;
+	}
+	debug(level, "Process: %llu periods, min %.1f mean %.1f p50 %.1f p99 %.1f"
+			" p99.9 %.1f max %.1f us, %.0f%% of a period at most",
+			(unsigned long long) stats.count, stats.min / 1000.0,
+			stats.mean / 1000.0, stats.p50 / 1000.0, stats.p99 / 1000.0,
+			stats.p999 / 1000.0, stats.max / 1000.0, stats.max_load * 100.0);
+	if (stats.dropped) {
+		debug(level, ", %u periods not timed", stats.dropped);
+	}
+	debug(level, "\n");
 }
 
-void display_meter(struct channel_info_t *info) {
-	char display_buffer[DISPLAY_WIDTH];
-	char *display_text = configure_buffer(display_buffer, '3' + info->channel);
-	debug(4, "Processing db=%d for channel %d\n", info->db, info->channel);
-	int size = iec_scale(info->db, CONSOLE_WIDTH);
-	debug(4, "size %d\n", size);
-	if (size > info->dpeak) {
-		info->dpeak = size;
-		info->dtime = 0;
-	} else if (info->dtime++ > decay_len) {
-		info->dpeak = size;
+void clear_display(struct display_info_t *display_info) {
+	if (display_info->channels_displaying > 0) {
+		lcd_screen_clear(&lcd_screen, FIRST_METER_ROW,
+				FIRST_METER_ROW + display_info->channels_displaying - 1);
 	}
-	debug(5, "display_buffer=%p\ndisplay_text=%p\ndpeak=%i\nsize=%i\n",
-			display_buffer, display_text, info->dpeak, size);
+}
+
+/*
+ * Draw a bar of size pixel columns with the bar glyphs, the last cell only
+ * partly filled.  As the bar moves within a cell only that cell changes, so
+ * the differential compose sends just the one character.  The hold is shown
+ * with peak_char in its cell when it is past the end of the bar.
+ */
+static void draw_glyph_bar(char *display_text, int size, int dpeak) {
+	int full = size / bar_steps;
+	int part = size % bar_steps;
+	int cells = full;
+	int i;
+	for (i = 0; i < full; i++) {
+		display_text[i] = LCD_BAR_GLYPH(bar_steps);
+	}
+	if (part) {
+		display_text[cells++] = LCD_BAR_GLYPH(part);
+	}
+	int hold = dpeak / bar_steps;
+	if (hold >= cells) {
+		display_text[hold < CONSOLE_WIDTH ? hold : CONSOLE_WIDTH - 1] =
+				peak_char;
+	}
+}
+
+void display_meter(int channel, int row) {
+	char display_text[CONSOLE_WIDTH];
+	float level = channel_store.level[channel];
+	debug(4, "Processing level=%f for channel %d\n", level, channel);
+	int size = meter_scale_deflection(&meter_scale, level);
+	debug(4, "size %d\n", size);
+	int dpeak = meter_scale_deflection(&meter_scale, channel_store.hold[channel]);
+	debug(5, "dpeak=%i\nsize=%i\n", dpeak, size);
 
 	memset(display_text, ' ', CONSOLE_WIDTH * sizeof(char));
-	memset(display_text, meter_char, size * sizeof(char));
-	display_text[info->dpeak] = peak_char;
+	if (bar_steps > 1) {
+		draw_glyph_bar(display_text, size, dpeak);
+	} else {
+		memset(display_text, meter_char, size * sizeof(char));
+		// a full scale peak sits in the last column
+		display_text[dpeak < CONSOLE_WIDTH ? dpeak : CONSOLE_WIDTH - 1] =
+				peak_char;
+	}
 
-	// write the line
-	write_buffer_to_lcd(display_buffer, DISPLAY_WIDTH);
+	lcd_screen_draw(&lcd_screen, row, 0, display_text, CONSOLE_WIDTH);
 }
 
-void display_db(struct channel_info_t const *info) {
-	debug(4, "Processing db=%d for channel %d\n", info->db, info->channel);
-	char display_buffer[DISPLAY_WIDTH];
-	char *display_text = configure_buffer(display_buffer, '3' + info->channel);
-	memset(display_text, ' ', CONSOLE_WIDTH * sizeof(char));
-	sprintf(display_text, "%1.1f", info->db);
+void display_db(int channel, int row) {
+	float db = channel_store.db[channel];
+	debug(4, "Processing db=%f for channel %d\n", db, channel);
+	char display_text[CONSOLE_WIDTH + 1];
+	int size = snprintf(display_text, sizeof(display_text), "%1.1f", db);
+	if (channel_store.mode[channel] != METER_PEAK) {
+		size += snprintf(&display_text[size], sizeof(display_text) - size, " %s",
+				meter_mode_name(channel_store.mode[channel]));
+	}
+	memset(&display_text[size], ' ', (CONSOLE_WIDTH - size) * sizeof(char));
+
+	debug(5, "Disp: %.*s\n", CONSOLE_WIDTH, display_text);
+	lcd_screen_draw(&lcd_screen, row, 0, display_text, CONSOLE_WIDTH);
+}
+
+/* the momentary and short term loudness last drawn, for the frame pacer */
+static float shown_loudness[2] = { -INFINITY, -INFINITY };
+
+/* Write a loudness in 5 characters, -inf when there is nothing to measure */
+static int format_lufs(char *text, size_t size, float lufs) {
+	if (lufs < -99.9f) {
+		return snprintf(text, size, " -inf");
+	}
+	return snprintf(text, size, "%5.1f", lufs);
+}
 
-	debug(5, "Disp: %s\n", display_text);
-	// write the line
-	write_buffer_to_lcd(display_buffer, DISPLAY_WIDTH);
+/*
+ * The loudness display takes the meter rows, the momentary and short term
+ * loudness on the first and the integrated loudness and range on the second.
+ */
+void display_loudness(int line, int row) {
+	char display_text[CONSOLE_WIDTH + 1];
+	char first[8];
+	char second[8];
+	int size;
+	if (line == 0) {
+		shown_loudness[0] = loudness_momentary(&loudness);
+		shown_loudness[1] = loudness_short_term(&loudness);
+		format_lufs(first, sizeof(first), shown_loudness[0]);
+		format_lufs(second, sizeof(second), shown_loudness[1]);
+		size = snprintf(display_text, sizeof(display_text), "M %s S %s LUFS",
+				first, second);
+	} else {
+		format_lufs(first, sizeof(first), loudness_integrated(&loudness));
+		size = snprintf(display_text, sizeof(display_text), "I %s LRA %4.1f LU",
+				first, loudness_range(&loudness));
+	}
+	if (size > CONSOLE_WIDTH) {
+		size = CONSOLE_WIDTH;
+	}
+	memset(&display_text[size], ' ', (CONSOLE_WIDTH - size) * sizeof(char));
+	lcd_screen_draw(&lcd_screen, row, 0, display_text, CONSOLE_WIDTH);
+}
+
+/*
+ * The status row is the xruns and the recording time from the left and the
+ * overs of all the channels at the right.  It is drawn whole whenever one of
+ * them changes, so a field that grows never leaves pieces of another behind,
+ * and the left is cut short rather than run into the overs.
+ */
+void display_status(struct display_info_t *display_info) {
+	if (!display_info->recording) {
+		return;
+	}
+	char left[64];
+	char overs[CONSOLE_WIDTH + 1];
+	char display_text[CONSOLE_WIDTH];
+	int left_size = 0;
+	int overs_size = 0;
+	if (display_info->channels_displaying) {
+		left_size = snprintf(left, sizeof(left), "X: %d ",
+				display_info->xrun_shown);
+		overs_size = snprintf(overs, sizeof(overs), " O:%u",
+				display_info->overs_shown);
+		if (overs_size > CONSOLE_WIDTH) {
+			overs_size = CONSOLE_WIDTH;
+		}
+	}
+	left_size += snprintf(&left[left_size], sizeof(left) - left_size,
+			"  T:%02lu:%02lu",
+			(unsigned long) display_info->elapsed_seconds / 60,
+			(unsigned long) display_info->elapsed_seconds % 60);
+	if (left_size > CONSOLE_WIDTH - overs_size) {
+		left_size = CONSOLE_WIDTH - overs_size;
+	}
+	memset(display_text, ' ', CONSOLE_WIDTH * sizeof(char));
+	memcpy(display_text, left, left_size);
+	memcpy(&display_text[CONSOLE_WIDTH - overs_size], overs, overs_size);
+	lcd_screen_draw(&lcd_screen, STATUS_ROW, 0, display_text, CONSOLE_WIDTH);
 }
 
-void display_xrun(struct display_info_t *display_info) {
-	if (display_info->channels_displaying && display_info->recording) {
-		char display_buffer[DISPLAY_WIDTH];
-		char *display_text = configure_buffer(display_buffer, '2');
-		display_info->xrun_len = (char) sprintf(display_text, "X: %d",
-				display_info->xrun_count);
-		write_buffer_to_lcd(display_buffer,
-				DISPLAY_SIZE(display_info->xrun_len));
+/* Report the clip counters and max peak of each channel that has any */
+void report_clips(unsigned int level) {
+	unsigned int channel;
+	for (channel = 0; channel < channel_store.count; channel++) {
+		unsigned int overs = atomic_load_explicit(&channel_store.overs[channel],
+				memory_order_relaxed);
+		unsigned int clipped = atomic_load_explicit(
+				&channel_store.clipped[channel], memory_order_relaxed);
+		float max_peak = channel_store.max_peak[channel];
+		if (max_peak > 0.0f) {
+			char when[16];
+			strftime(when, sizeof(when), "%H:%M:%S",
+					localtime(&channel_store.max_peak_time[channel]));
+			debug(level,
+					"Channel %u: %u overs, %u clipped samples, max peak %.1f dBFS at %s\n",
+					channel, overs, clipped, 20.0f * log10f(max_peak), when);
+		}
 	}
 }
 
-static int increment_xrun(void *arg) {
+/* Callback called by JACK on an xrun.  The display is updated by the main loop */
+int increment_xrun(void *arg) {
 	struct display_info_t *display_info = (struct display_info_t*) arg;
-	if (display_info->xrun_count >= 0) {
-		debug(4, "XRUN\n");
+	int count = atomic_fetch_add_explicit(&display_info->xrun_count, 1,
+			memory_order_relaxed) + 1;
+	rt_log_event(&xrun_log, 4, RT_EVENT_XRUN, 0, count, 0.0f);
+	meter_shm_xrun(&meter_shm);
+	metrics_count(&metrics.xruns, 1);
+	if (wake_fd >= 0) {
+		const uint64_t one = 1;
+		if (write(wake_fd, &one, sizeof(one)) < 0) {
+			// the counter is already signalled
+		}
 	}
-	display_info->xrun_count++;
-	display_xrun(display_info);
 	return 0;
 }
 
+static void report_log(struct rt_log *log) {
+	struct rt_event event;
+	while (rt_log_next(log, &event)) {
+		switch (event.type) {
+		case RT_EVENT_PORT_DISABLED:
+			debug(event.level, "Channel %d is not enabled\n", event.channel);
+			break;
+		case RT_EVENT_PEAK:
+			debug(event.level, "Channel %d period peak %f\n", event.channel,
+					event.value);
+			break;
+		case RT_EVENT_XRUN:
+			debug(event.level, "XRUN %d\n", event.count);
+			break;
+		case RT_EVENT_RMS_WINDOW:
+			debug(event.level,
+					"The RMS window is cut to %.3f seconds, %d periods of %d frames\n",
+					event.value, RMS_MAX_BLOCKS, event.count);
+			break;
+		}
+	}
+	unsigned int dropped = atomic_exchange_explicit(&log->dropped, 0,
+			memory_order_relaxed);
+	if (dropped) {
+		debug(4, "%u realtime events dropped\n", dropped);
+	}
+}
+
+/*
+ * Format the events recorded by the JACK callbacks and show any new xruns.
+ * Called from the main loop, never from a JACK thread.
+ */
+void report_rt_events(struct display_info_t *display_info) {
+	report_log(&process_log);
+	report_log(&xrun_log);
+	int count = atomic_load_explicit(&display_info->xrun_count,
+			memory_order_relaxed);
+	if (count != display_info->xrun_shown) {
+		display_info->xrun_shown = count;
+		display_status(display_info);
+	}
+	unsigned int overs = 0;
+	unsigned int channel;
+	for (channel = 0; channel < channel_store.count; channel++) {
+		overs += atomic_load_explicit(&channel_store.overs[channel],
+				memory_order_relaxed);
+	}
+	if (overs != display_info->overs_shown) {
+		display_info->overs_shown = overs;
+		display_status(display_info);
+	}
+}
+
 char* copy_malloc(const char *s) {
 	return strcpy((char*) malloc(sizeof(char) * (strlen(s) + 1)), s);
 }
@@ -384,17 +744,28 @@ void remove_fifo(const char *name) {
 	}
 }
 
-FILE* make_fifo(const char *name) {
+/*
+ * The fifo is opened for writing as well as reading so that it never reports
+ * end of file, and so never wakes the main loop, when the last writer closes.
+ */
+int make_fifo(const char *name) {
 	remove_fifo(fifo_name);
+	free_copy(fifo_name);
 	fifo_name = copy_malloc(name);
 	remove_fifo(fifo_name);
 	debug(3, "Creating fifo %s\n", fifo_name);
 	umask(0);
 	mkfifo(fifo_name, 0666);
-	int fd1 = open(fifo_name, O_RDONLY | O_NONBLOCK);
-	FILE *f = fdopen(fd1, "r");
-	setbuf(f, NULL);
-	return f;
+	return open(fifo_name, O_RDWR | O_NONBLOCK);
+}
+
+/*
+ * Send the last frame and close the display, also registered on its own so
+ * a terminal display is restored if the meter exits before it is running.
+ */
+static void close_lcd() {
+	lcd_writer_stop(&lcd_writer, &lcd_screen);
+	display_close(&lcd_display);
 }
 
 /* Close down JACK when exiting */
@@ -403,43 +774,90 @@ static void cleanup() {
 	unsigned int i;
 	unsigned int channel;
 	debug(2, "cleanup()\n");
+	// the writer sends the last frame before the report
+	close_lcd();
+	report_lcd_stats(3);
+	report_clips(3);
 
-	for (channel = 0; channel < MAX_CHANNELS; channel++) {
-		if (channel_info[channel].input_port != NULL) {
+	for (channel = 0; channel < channel_store.count; channel++) {
+		if (channel_store.input_port[channel] != NULL) {
 
 			all_ports = jack_port_get_all_connections(client,
-					channel_info[channel].input_port);
+					channel_store.input_port[channel]);
 
 			for (i = 0; all_ports && all_ports[i]; i++) {
 				jack_disconnect(client, all_ports[i],
-						jack_port_name(channel_info[channel].input_port));
+						jack_port_name(channel_store.input_port[channel]));
 			}
 		}
 	}
 	/* Leave the jack graph */
 	jack_client_close(client);
+#ifdef PROCESS_TIMING
+	report_process_timing(3);
+#endif
+	process_timing_free(&process_timing);
+	meter_shm_close(&meter_shm);
+	free_copy(shm_name);
+	rt_log_free(&process_log);
+	rt_log_free(&xrun_log);
+	if (wake_fd >= 0) {
+		close(wake_fd);
+	}
+	if (fifo >= 0) {
+		close(fifo);
+	}
+	control_server_close(&control_server);
+	free_copy(socket_name);
+	metrics_server_close(&metrics_server);
+	free_copy(metrics_address);
+	loudness_free(&loudness);
+	free(loudness_weights);
+	ballistics_free(&ballistics);
+	channel_store_free(&channel_store);
+	meter_scale_free(&meter_scale);
 	remove_fifo(fifo_name);
 	free_copy(fifo_name);
 	free_copy(server_name);
 	free_copy(lcd_device);
+	free_copy(display_name);
+	if (trace) {
+		fclose(trace);
+	}
+	free_copy(trace_name);
 }
 
-void clear_recording_status() {
-	char display_buffer[DISPLAY_WIDTH];
-	char *text_buffer = configure_buffer(display_buffer, '2');
-	int size = sprintf(text_buffer, CLEAR_LINE, ESC, CLEAR_ALL);
-	write_buffer_to_lcd(display_buffer, DISPLAY_SIZE(size));
+/* Run the ballistics of a channel's mode, and the RMS --shm publishes */
+static void want_meter_modes(unsigned int channel) {
+	unsigned int modes = METER_MODE_BIT(channel_store.mode[channel]);
+	if (shm_name) {
+		modes |= METER_MODE_BIT(METER_RMS);
+	}
+	ballistics_want(&ballistics, channel, modes);
 }
 
-int check_cmd(struct display_info_t *display_info) {
-	// check for state change
-	clearerr(fifo);
-	char cmd = fgetc(fifo);
-	int err = ferror(fifo);
-	if (err) {
-		debug(3, "Read error on fifo: %d", err);
-		return 1;
+/* Move the channels on the display to the next meter mode */
+void next_meter_mode(struct display_info_t *display_info) {
+	int row;
+	for (row = 0; row < display_info->channels_displaying; row++) {
+		unsigned int channel = display_info->first_channel + row;
+		if (channel < channel_store.count) {
+			channel_store.mode[channel] = (channel_store.mode[channel] + 1)
+					% METER_MODES;
+			channel_store.hold[channel] = 0.0f;
+			want_meter_modes(channel);
+			debug(3, "Channel %u shows %s\n", channel,
+					meter_mode_name(channel_store.mode[channel]));
+		}
 	}
+}
+
+void clear_recording_status() {
+	lcd_screen_clear(&lcd_screen, STATUS_ROW, STATUS_ROW);
+}
+
+/* Carry out a command, returns 0 if the program should exit */
+int run_cmd(struct display_info_t *display_info, char cmd) {
 	switch (cmd) {
 	case CMD_NO_DISPLAY:
 		clear_display(display_info);
@@ -453,6 +871,17 @@ int check_cmd(struct display_info_t *display_info) {
 		clear_display(display_info);
 		display_info->channels_displaying = 2;
 		break;
+	case CMD_NEXT_CHANNELS:
+		if (display_info->first_channel + display_info->channels_displaying
+				< display_info->channels_installed) {
+			display_info->first_channel++;
+		}
+		break;
+	case CMD_PREVIOUS_CHANNELS:
+		if (display_info->first_channel > 0) {
+			display_info->first_channel--;
+		}
+		break;
 	case CMD_STOP_RECORDING:
 		display_info->recording = 0;
 		clear_recording_status();
@@ -462,9 +891,27 @@ int check_cmd(struct display_info_t *display_info) {
 		clear_recording_status();
 		time(&display_info->start_time);
 		display_info->elapsed_seconds = 0;
-		display_info->xrun_count = 0;
-		display_xrun(display_info);
-		display_time(display_info);
+		atomic_store(&display_info->xrun_count, 0);
+		display_info->xrun_shown = 0;
+		display_status(display_info);
+		break;
+	case CMD_NEXT_MODE:
+		next_meter_mode(display_info);
+		break;
+	case CMD_RESET_LOUDNESS:
+		loudness_reset(&loudness);
+		break;
+	case CMD_RESET_CLIPS:
+		channel_store_reset_clips(&channel_store);
+		break;
+	case CMD_REPORT_CLIPS:
+		report_clips(1);
+		break;
+	case CMD_STATS:
+		report_lcd_stats(1);
+		break;
+	case CMD_REPORT_TIMING:
+		report_process_timing(1);
 		break;
 	case CMD_EXIT: // exit program
 		if (display_info->recording) {
@@ -476,52 +923,771 @@ int check_cmd(struct display_info_t *display_info) {
 	return 1;
 }
 
+/* Carry out the commands waiting in the fifo, returns 0 if the program should exit */
+int check_cmd(struct display_info_t *display_info) {
+	char cmds[64];
+	ssize_t len;
+	while ((len = read(fifo, cmds, sizeof(cmds))) > 0) {
+		ssize_t i;
+		for (i = 0; i < len; i++) {
+			if (!run_cmd(display_info, cmds[i])) {
+				return 0;
+			}
+		}
+	}
+	if (len < 0 && errno != EAGAIN && errno != EINTR) {
+		debug(3, "Read error on fifo: %d\n", errno);
+	}
+	return 1;
+}
+
+/* The fifo commands by name for the control socket */
+static const struct {
+	const char *name;
+	char cmd;
+} command_names[] = {
+	{ "none", CMD_NO_DISPLAY },
+	{ "one", CMD_ONE_DISPLAY },
+	{ "two", CMD_TWO_DISPLAY },
+	{ "next", CMD_NEXT_CHANNELS },
+	{ "previous", CMD_PREVIOUS_CHANNELS },
+	{ "stop", CMD_STOP_RECORDING },
+	{ "start", CMD_START_RECORDING },
+	{ "exit", CMD_EXIT },
+	{ "stats", CMD_STATS },
+	{ "mode", CMD_NEXT_MODE },
+	{ "reset-loudness", CMD_RESET_LOUDNESS },
+	{ "reset-clips", CMD_RESET_CLIPS },
+	{ "clips", CMD_REPORT_CLIPS },
+	{ "report-timing", CMD_REPORT_TIMING },
+	{ NULL, 0 }
+};
+
+/*
+ * Carry out a line from a control socket client, returns 0 if the program
+ * should exit.  A fifo command, by its character or its name, is answered
+ * with OK, a query with OK and its values, and anything else with ERR.
+ */
+static int run_control(struct control_client_t *client, char *line,
+		void *context) {
+	struct display_info_t *display_info = (struct display_info_t*) context;
+	char *save = NULL;
+	char *word = strtok_r(line, " \t", &save);
+	unsigned int channel;
+	int i;
+	if (word == NULL) {
+		return 1;
+	}
+	for (i = 0; command_names[i].name; i++) {
+		if (!strcmp(word, command_names[i].name)
+				|| (word[0] == command_names[i].cmd && word[1] == '\0')) {
+			control_client_printf(client, "OK\n");
+			return run_cmd(display_info, command_names[i].cmd);
+		}
+	}
+	if (!strcmp(word, "peak")) {
+		control_client_printf(client, "OK");
+		for (channel = 0; channel < channel_store.count; channel++) {
+			control_client_printf(client, " %.6f",
+					channel_store.last_peak[channel]);
+		}
+		control_client_printf(client, "\n");
+	} else if (!strcmp(word, "db")) {
+		control_client_printf(client, "OK");
+		for (channel = 0; channel < channel_store.count; channel++) {
+			control_client_printf(client, " %.1f", 20.0f
+					* log10f(channel_store.level[channel] * display_info->bias));
+		}
+		control_client_printf(client, "\n");
+	} else if (!strcmp(word, "subscribe")) {
+		char *rate = strtok_r(NULL, " \t", &save);
+		int frames = rate ? atoi(rate) : display_info->update_rate;
+		if (frames < 0 || frames > display_info->update_rate) {
+			control_client_printf(client,
+					"ERR the rate must be from 0 to %d frames per second\n",
+					display_info->update_rate);
+		} else {
+			// the reply is framed if the client was subscribed, 0 stops it
+			control_client_printf(client, "OK %d\n", frames);
+			control_client_subscribe(client, frames);
+		}
+	} else if (!strcmp(word, "xruns")) {
+		control_client_printf(client, "OK %d\n",
+				atomic_load(&display_info->xrun_count));
+	} else if (!strcmp(word, "timing")) {
+		struct process_timing_stats_t stats;
+		if (process_timing_stats(&process_timing, &stats)) {
+			control_client_printf(client, "ERR process timing is not built in\n");
+		} else {
+			control_client_printf(client,
+					"OK %llu %.0f %.0f %.0f %.0f %.0f %.0f %.3f %u\n",
+					(unsigned long long) stats.count, stats.min, stats.mean,
+					stats.p50, stats.p99, stats.p999, stats.max,
+					stats.max_load, stats.dropped);
+		}
+	} else if (!strcmp(word, "time")) {
+		// the display only keeps the time while it shows meters
+		time_t seconds = display_info->recording ?
+				time(NULL) - display_info->start_time :
+				display_info->elapsed_seconds;
+		control_client_printf(client, "OK %d %ld\n", display_info->recording,
+				(long) seconds);
+	} else {
+		control_client_printf(client, "ERR unknown command %s\n", word);
+	}
+	return 1;
+}
+
+#define METER_FRAME_SIZE (sizeof(struct meter_frame_header_t) \
+		+ MAX_CHANNELS * sizeof(struct meter_frame_channel_t))
+_Static_assert(METER_FRAME_SIZE <= CONTROL_OUT_SIZE,
+		"a meter frame must fit in a control client's output");
+
+/* Stream the levels of this display frame to the control socket subscribers */
+static void publish_meter_frame(struct display_info_t *display_info) {
+	static uint32_t sequence = 0;
+	static char frame[METER_FRAME_SIZE];
+	struct meter_frame_header_t *header = (struct meter_frame_header_t*) frame;
+	struct meter_frame_channel_t *record =
+			(struct meter_frame_channel_t*) (header + 1);
+	unsigned int channel;
+	sequence++;
+	if (!control_server_subscribers(&control_server)) {
+		return;
+	}
+	memcpy(header->magic, METER_FRAME_MAGIC, sizeof(header->magic));
+	header->size = sizeof(struct meter_frame_header_t)
+			+ channel_store.count * sizeof(struct meter_frame_channel_t);
+	header->sequence = sequence;
+	header->channels = channel_store.count;
+	header->update_rate = display_info->update_rate;
+	header->xruns = atomic_load(&display_info->xrun_count);
+	header->elapsed = display_info->recording ?
+			time(NULL) - display_info->start_time : 0;
+	header->flags = display_info->recording ? METER_FRAME_RECORDING : 0;
+	for (channel = 0; channel < channel_store.count; channel++) {
+		record[channel].peak = channel_store.last_peak[channel];
+		record[channel].db = 20.0f
+				* log10f(channel_store.level[channel] * display_info->bias);
+		record[channel].hold = channel_store.hold[channel];
+		record[channel].overs = atomic_load_explicit(
+				&channel_store.overs[channel], memory_order_relaxed);
+		record[channel].clipped = atomic_load_explicit(
+				&channel_store.clipped[channel], memory_order_relaxed);
+		record[channel].mode = channel_store.mode[channel];
+		memset(record[channel].reserved, 0, sizeof(record[channel].reserved));
+		record[channel].max_peak = channel_store.max_peak[channel];
+	}
+	control_server_publish(&control_server, frame, header->size,
+			display_info->update_rate);
+}
+
+/* Write a gauge family with a sample for each channel */
+static void write_channel_gauge(FILE *out, const char *name, const char *help,
+		float (*value)(unsigned int channel)) {
+	unsigned int channel;
+	fprintf(out, "# TYPE %s gauge\n", name);
+	fprintf(out, "# HELP %s %s.\n", name, help);
+	for (channel = 0; channel < channel_store.count; channel++) {
+		fprintf(out, "%s{channel=\"%u\"} %.9g\n", name, channel,
+				value(channel));
+	}
+}
+
+/* Write a counter family with a sample for each channel */
+static void write_channel_counter(FILE *out, const char *name,
+		const char *help, _Atomic uint32_t *counts) {
+	unsigned int channel;
+	fprintf(out, "# TYPE %s counter\n", name);
+	fprintf(out, "# HELP %s %s.\n", name, help);
+	for (channel = 0; channel < channel_store.count; channel++) {
+		fprintf(out, "%s_total{channel=\"%u\"} %u\n", name, channel,
+				atomic_load_explicit(&counts[channel], memory_order_relaxed));
+	}
+}
+
+static float channel_peak(unsigned int channel) {
+	return channel_store.last_peak[channel];
+}
+
+static float channel_hold(unsigned int channel) {
+	return channel_store.hold[channel];
+}
+
+static float channel_max_peak(unsigned int channel) {
+	return channel_store.max_peak[channel];
+}
+
+/* Write the metrics for a scrape of the --metrics endpoint */
+static void write_metrics(FILE *out, void *context) {
+	metrics_write_counter(out, "jackmeter_xruns", "JACK xruns since the start",
+			atomic_load(&metrics.xruns));
+#ifdef PROCESS_TIMING
+	// the percentiles of the t command rather than estimates from the buckets
+	double process_ns[METRICS_QUANTILES];
+	int i;
+	process_timing_drain(&process_timing);
+	for (i = 0; i < METRICS_QUANTILES; i++) {
+		process_ns[i] = process_timing_percentile(&process_timing,
+				metrics_quantiles[i]);
+	}
+	metrics_write_timing_quantiles(out, "jackmeter_process",
+			"JACK process callback duration", &metrics.process, process_ns);
+#else
+	metrics_write_timing(out, "jackmeter_process",
+			"JACK process callback duration", &metrics.process);
+#endif
+	write_channel_gauge(out, "jackmeter_peak",
+			"Sample peak of the last display frame, 1 is full scale",
+			channel_peak);
+	write_channel_gauge(out, "jackmeter_peak_hold",
+			"Peak hold of the level the bar shows, 1 is full scale",
+			channel_hold);
+	write_channel_gauge(out, "jackmeter_max_peak",
+			"Highest peak since the clip counters were reset", channel_max_peak);
+	write_channel_counter(out, "jackmeter_overs",
+			"Runs of 3 or more full scale samples since the last reset",
+			channel_store.overs);
+	write_channel_counter(out, "jackmeter_clipped_samples",
+			"Full scale samples since the last reset", channel_store.clipped);
+	metrics_write_timing(out, "jackmeter_lcd_write", "LCD write duration",
+			&metrics.lcd_write);
+	metrics_write_sizes(out, "jackmeter_lcd_write", "LCD write size",
+			&metrics.lcd_write_size);
+	metrics_write_counter(out, "jackmeter_lcd_bytes", "Bytes written to the LCD",
+			atomic_load(&metrics.lcd_bytes));
+	metrics_write_gauge(out, "jackmeter_lcd_throughput_bytes_per_second",
+			"Bytes the LCD took per second of write time", lcd_link.throughput);
+	metrics_write_gauge(out, "jackmeter_lcd_link_busy_ratio",
+			"Share of the last second spent writing to the LCD", lcd_link.busy);
+	metrics_write_gauge(out, "jackmeter_lcd_frame_divisor",
+			"One display frame in this many is sent to the LCD",
+			lcd_link.divisor);
+	metrics_write_counter(out, "jackmeter_lcd_short_writes",
+			"LCD writes that did not write every byte",
+			atomic_load(&metrics.lcd_short_writes));
+	metrics_write_counter(out, "jackmeter_frames_missed",
+			"Display frames the main loop was too late for",
+			atomic_load(&metrics.frames_missed));
+	metrics_write_counter(out, "jackmeter_lcd_frames_dropped",
+			"Display frames dropped because the LCD writer was behind",
+			atomic_load(&lcd_writer.dropped));
+	metrics_write_counter(out, "jackmeter_lcd_frames_merged",
+			"Display frames the LCD writer skipped for a newer one",
+			atomic_load(&lcd_writer.merged));
+}
+
+/* The level a channel's meter mode would show now, without taking a peak */
+static float waiting_level(unsigned int channel) {
+	switch (channel_store.mode[channel]) {
+	case METER_PEAK:
+		return peek_peak(&channel_store.peak[channel]);
+	case METER_TRUE_PEAK:
+		return ballistics_peek_true_peak(&ballistics, channel);
+	default:
+		return ballistics_level(&ballistics, channel, channel_store.mode[channel]);
+	}
+}
+
+/*
+ * Whether a level waiting for the display would raise what a channel on the
+ * display shows: its bar, its number to a tenth of a dB with -n, or the
+ * momentary or short term loudness with -L.
+ */
+static int displayed_transient(struct display_info_t *display_info) {
+	int row;
+	if (display_info->decibels_mode == 2) {
+		// a silent reading is -inf, and -inf less -inf is no rise
+		return loudness_momentary(&loudness) - shown_loudness[0] >= 0.1f
+				|| loudness_short_term(&loudness) - shown_loudness[1] >= 0.1f;
+	}
+	for (row = 0; row < display_info->channels_displaying; row++) {
+		int channel = display_info->first_channel + row;
+		if (channel >= display_info->channels_installed) {
+			break;
+		}
+		float level = waiting_level(channel);
+		if (display_info->decibels_mode == 1) {
+			if (20.0f * log10f(level * display_info->bias)
+					- channel_store.db[channel] >= 0.1f) {
+				return 1;
+			}
+		} else if (meter_scale_deflection(&meter_scale, level)
+				> meter_scale_deflection(&meter_scale,
+						channel_store.level[channel])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Start the frame timer, the first frame is one period from now */
+int start_frame_timer(int timer, int update_rate) {
+	struct itimerspec period;
+	long nsecs = 1000000000L / update_rate;
+	period.it_interval.tv_sec = nsecs / 1000000000L;
+	period.it_interval.tv_nsec = nsecs % 1000000000L;
+	period.it_value = period.it_interval;
+	return timerfd_settime(timer, 0, &period, NULL);
+}
+
+/*
+ * The main loop waits for the frame timer, a command on the fifo or a wake up
+ * from the JACK thread.  The timer keeps the frames at the update rate however
+ * long a frame takes to draw, and commands are acted on as soon as they
+ * arrive.
+ */
+void run_event_loop(struct display_info_t *display_info) {
+	enum {
+		POLL_TIMER, POLL_FIFO, POLL_WAKE, POLL_COUNT
+	};
+	struct pollfd fds[POLL_COUNT + CONTROL_POLL_FDS + METRICS_POLL_FDS];
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer < 0 || start_frame_timer(timer, display_info->update_rate)) {
+		debug(1, "Cannot create the frame timer: %d\n", errno);
+		exit(1);
+	}
+	fds[POLL_TIMER].fd = timer;
+	fds[POLL_FIFO].fd = fifo;
+	fds[POLL_WAKE].fd = wake_fd;
+	lcd_link_init(&lcd_link, adapt_link, display_info->update_rate,
+			metrics_now_ns());
+	frame_pacer_init(&frame_pacer, display_info->update_rate, idle_rate);
+	int running = 1;
+	while (running) {
+		int frame_due = 0;
+		int i;
+		for (i = 0; i < POLL_COUNT; i++) {
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		int control_fds = control_server_pollfds(&control_server,
+				&fds[POLL_COUNT]);
+		struct pollfd *metrics_fds = &fds[POLL_COUNT + control_fds];
+		int metrics_fd_count = metrics_server_pollfds(&metrics_server,
+				metrics_fds);
+		if (poll(fds, POLL_COUNT + control_fds + metrics_fd_count, -1) < 0) {
+			if (errno != EINTR) {
+				debug(1, "poll failed: %d\n", errno);
+				break;
+			}
+			continue;
+		}
+		/*
+		 * Rows held back from the last frame wait for the next one, but a
+		 * command or an xrun that draws on the screen is sent at once.
+		 */
+		unsigned int drawn_rows = lcd_screen.drawn_rows;
+		lcd_screen.drawn_rows = 0;
+		if (fds[POLL_FIFO].revents & POLLIN) {
+			running = check_cmd(display_info);
+		}
+		if (!control_server_handle(&control_server, &fds[POLL_COUNT],
+				control_fds)) {
+			running = 0;
+		}
+		if (fds[POLL_WAKE].revents & POLLIN) {
+			uint64_t wakes;
+			if (read(wake_fd, &wakes, sizeof(wakes)) > 0) {
+				report_rt_events(display_info);
+			}
+		}
+		frame_due = lcd_screen.drawn_rows != 0;
+		lcd_screen.drawn_rows |= drawn_rows;
+		metrics_server_handle(&metrics_server, metrics_fds, metrics_fd_count);
+		if (fds[POLL_TIMER].revents & POLLIN) {
+			uint64_t expirations = 1;
+			if (read(timer, &expirations, sizeof(expirations)) > 0
+					&& expirations > 1) {
+				debug(4, "%llu frames missed\n",
+						(unsigned long long) expirations - 1);
+				metrics_count(&metrics.frames_missed, expirations - 1);
+			}
+			report_rt_events(display_info);
+			process_timing_drain(&process_timing);
+			// subscribers and the trace are promised every frame
+			int frame_drawn = frame_pacer_due(&frame_pacer, (int) expirations,
+					displayed_transient(display_info),
+					control_server_subscribers(&control_server) || trace);
+			if (frame_drawn) {
+				display_info->frame_ns = metrics_now_ns();
+				update_display(display_info);
+				publish_meter_frame(display_info);
+			}
+			if (lcd_link_update(&lcd_link, metrics_now_ns(),
+					atomic_load(&metrics.lcd_bytes),
+					atomic_load(&metrics.lcd_write.sum_ns),
+					atomic_load(&lcd_writer.dropped)
+							+ atomic_load(&lcd_writer.merged))) {
+				debug(3, "LCD link %.0f%% busy, sending 1 frame in %d\n",
+						lcd_link.busy * 100.0, lcd_link.divisor);
+			}
+			if (frame_drawn && lcd_link_frame_due(&lcd_link)) {
+				frame_due = 1;
+			}
+		}
+		// the frames left out keep their drawn rows for the next one sent
+		if (frame_due) {
+			flush_lcd();
+		}
+	}
+	close(timer);
+}
+
+/*
+ * Take the peaks of every channel, so a channel scrolled onto the display
+ * shows its current level rather than the peak since it was last shown.
+ */
+void update_levels(struct display_info_t *display_info) {
+	unsigned int channel;
+	for (channel = 0; channel < channel_store.count; channel++) {
+		channel_store.last_peak[channel] = take_peak(&channel_store.peak[channel]);
+		channel_store.last_true_peak[channel] = ballistics_take_true_peak(
+				&ballistics, channel);
+	}
+	for (channel = 0; channel < channel_store.count; channel++) {
+		if (channel_store.last_peak[channel] > channel_store.max_peak[channel]) {
+			channel_store.max_peak[channel] = channel_store.last_peak[channel];
+			channel_store.max_peak_time[channel] = time(NULL);
+		}
+	}
+	for (channel = 0; channel < channel_store.count; channel++) {
+		int mode = channel_store.mode[channel];
+		if (mode == METER_PEAK) {
+			channel_store.level[channel] = channel_store.last_peak[channel];
+		} else if (mode == METER_TRUE_PEAK) {
+			channel_store.level[channel] = channel_store.last_true_peak[channel];
+		} else {
+			channel_store.level[channel] = ballistics_level(&ballistics, channel,
+					mode);
+		}
+	}
+	channel_store_update_holds(&channel_store, display_info->frame_ns,
+			hold_time, hold_falloff);
+	for (channel = 0; channel < channel_store.count; channel++) {
+		meter_shm_hold(&meter_shm, channel, channel_store.hold[channel]);
+	}
+	// the bar meters use meter_scale, only the numbers need the log
+	if (display_info->decibels_mode == 1) {
+		for (channel = 0; channel < channel_store.count; channel++) {
+			channel_store.db[channel] = 20.0f
+					* log10f(channel_store.level[channel] * display_info->bias);
+		}
+	}
+}
+
+/* Give each channel its mode from -M */
+void set_meter_modes() {
+	unsigned int channel;
+	for (channel = 0; channel < channel_store.count; channel++) {
+		if (meter_mode_count == 0) {
+			channel_store.mode[channel] = METER_PEAK;
+		} else if (channel < meter_mode_count) {
+			channel_store.mode[channel] = meter_modes[channel];
+		} else {
+			channel_store.mode[channel] = meter_modes[meter_mode_count - 1];
+		}
+		want_meter_modes(channel);
+	}
+}
+
+/* Parse the -M list of modes, returns 0 on success */
+int parse_meter_modes(const char *list) {
+	char *copy = copy_malloc(list);
+	char *name;
+	char *save = NULL;
+	meter_mode_count = 0;
+	for (name = strtok_r(copy, ",", &save);
+			name && meter_mode_count < MAX_CHANNELS;
+			name = strtok_r(NULL, ",", &save)) {
+		int mode = meter_mode_parse(name);
+		if (mode < 0) {
+			debug(1, "Unknown meter mode '%s'\n", name);
+			free_copy(copy);
+			return -1;
+		}
+		meter_modes[meter_mode_count++] = mode;
+	}
+	free_copy(copy);
+	return 0;
+}
+
+/* Parse the --weights list of channel weights, returns 0 on success */
+int parse_loudness_weights(const char *list) {
+	char *copy = copy_malloc(list);
+	char *name;
+	char *save = NULL;
+	const char *c;
+	unsigned int count = 1;
+	for (c = list; *c; c++) {
+		count += *c == ',';
+	}
+	free(loudness_weights);
+	loudness_weights = malloc(count * sizeof(float));
+	loudness_weight_count = 0;
+	for (name = strtok_r(copy, ",", &save); name;
+			name = strtok_r(NULL, ",", &save)) {
+		char *end;
+		float weight = strtof(name, &end);
+		if (end == name || *end || weight < 0.0f) {
+			debug(1, "Bad channel weight '%s'\n", name);
+			free_copy(copy);
+			return -1;
+		}
+		loudness_weights[loudness_weight_count++] = weight;
+	}
+	free_copy(copy);
+	return 0;
+}
+
+/* Write a line with the peak of each channel taken this frame */
+static void write_trace_frame(FILE *trace) {
+	unsigned int channel;
+	for (channel = 0; channel < channel_store.count; channel++) {
+		fprintf(trace, channel ? " %g" : "%g", channel_store.last_peak[channel]);
+	}
+	fprintf(trace, "\n");
+}
+
 void update_display(struct display_info_t *display_info) {
+	update_levels(display_info);
+	if (trace) {
+		write_trace_frame(trace);
+	}
 	if (display_info->channels_displaying) {
-		int channel;
-		struct channel_info_t *info;
-		debug(4, "update %d displays\n", channels);
-		for (channel = 0; channel < display_info->channels_displaying;
-				channel++) {
-			info = &channel_info[channel];
-			info->last_peak = info->peak;
-			channel_info[channel].peak = 0.0f;
-			info->db = 20.0f * log10f(info->last_peak * display_info->bias);
-
+		int row;
+		debug(4, "update %d displays\n", display_info->channels_displaying);
+		for (row = 0; row < display_info->channels_displaying; row++) {
+			if (display_info->decibels_mode == 2) {
+				display_loudness(row, FIRST_METER_ROW + row);
+				continue;
+			}
+			int channel = display_info->first_channel + row;
+			if (channel >= display_info->channels_installed) {
+				break;
+			}
 			if (display_info->decibels_mode == 1) {
-				display_db(info);
+				display_db(channel, FIRST_METER_ROW + row);
 			} else {
-				display_meter(info);
+				display_meter(channel, FIRST_METER_ROW + row);
 			}
 		}
 		if (display_info->recording) {
 			time_t seconds = time(NULL) - display_info->start_time;
 			if (seconds != display_info->elapsed_seconds) {
 				display_info->elapsed_seconds = seconds;
-				display_time(display_info);
+				display_status(display_info);
 			}
 		}
 	}
 }
 
+/*
+ * FILE ANALYSIS
+ *
+ * A WAV file is metered by the same code as the JACK inputs, a period at a
+ * time, and the levels of each display frame are written as CSV.
+ */
+#define FILE_PERIOD 1024
+
+static void write_levels_header(FILE *out, unsigned int channels) {
+	unsigned int channel;
+	fprintf(out, "time");
+	for (channel = 0; channel < channels; channel++) {
+		fprintf(out,
+				",peak_%u,true_peak_%u,rms_%u,vu_%u,ppm_%u,db_%u,meter_%u,hold_%u",
+				channel, channel, channel, channel, channel, channel, channel,
+				channel);
+		fprintf(out, ",overs_%u,clipped_%u", channel, channel);
+	}
+	if (loudness.channels) {
+		fprintf(out, ",momentary,short_term,integrated,range");
+	}
+	fprintf(out, "\n");
+}
+
+static void write_levels(FILE *out, struct display_info_t *display_info,
+		double time) {
+	unsigned int channel;
+	fprintf(out, "%.3f", time);
+	for (channel = 0; channel < channel_store.count; channel++) {
+		float level = channel_store.level[channel];
+		int size = meter_scale_deflection(&meter_scale, level);
+		fprintf(out, ",%.6f,%.6f,%.6f,%.6f,%.6f,%.1f,%d,%d",
+				channel_store.last_peak[channel],
+				channel_store.last_true_peak[channel],
+				ballistics_level(&ballistics, channel, METER_RMS),
+				ballistics_level(&ballistics, channel, METER_VU),
+				ballistics_level(&ballistics, channel, METER_PPM),
+				20.0f * log10f(level * display_info->bias), size,
+				meter_scale_deflection(&meter_scale,
+						channel_store.hold[channel]));
+		fprintf(out, ",%u,%u",
+				atomic_load_explicit(&channel_store.overs[channel],
+						memory_order_relaxed),
+				atomic_load_explicit(&channel_store.clipped[channel],
+						memory_order_relaxed));
+	}
+	if (loudness.channels) {
+		fprintf(out, ",%.1f,%.1f,%.1f,%.1f", loudness_momentary(&loudness),
+				loudness_short_term(&loudness), loudness_integrated(&loudness),
+				loudness_range(&loudness));
+	}
+	fprintf(out, "\n");
+}
+
+int analyse_file(struct display_info_t *display_info, const char *file_name,
+		const char *csv_name) {
+	struct wav_file_t wav;
+	float *buffers[MAX_CHANNELS];
+	unsigned int channel;
+	size_t first = 0;
+	const char *error = wav_file_open(&wav, file_name);
+	if (error) {
+		debug(1, "Cannot read %s: %s\n", file_name, error);
+		return 1;
+	}
+	if (wav.channels > MAX_CHANNELS
+			|| channel_store_init(&channel_store, wav.channels)
+			|| ballistics_init(&ballistics, wav.channels, wav.sample_rate,
+					rms_window)) {
+		debug(1, "Cannot meter the %u channels of %s\n", wav.channels,
+				file_name);
+		wav_file_close(&wav);
+		return 1;
+	}
+	FILE *out = csv_name ? fopen(csv_name, "w") : stdout;
+	if (!out) {
+		debug(1, "Cannot create %s\n", csv_name);
+		wav_file_close(&wav);
+		return 1;
+	}
+	set_meter_modes();
+	// the CSV has every level of every channel, whatever its mode
+	for (channel = 0; channel < wav.channels; channel++) {
+		ballistics_want(&ballistics, channel, METER_ALL_MODES);
+	}
+	// the blocks are taken as each period is metered, without the worker
+	if (display_info->decibels_mode == 2) {
+		if (loudness_init(&loudness, wav.channels, wav.sample_rate)) {
+			debug(1, "Cannot allocate the loudness meter.\n");
+			wav_file_close(&wav);
+			return 1;
+		}
+		loudness_set_weights(&loudness, loudness_weights,
+				loudness_weight_count);
+	}
+	for (channel = 0; channel < wav.channels; channel++) {
+		buffers[channel] = (float*) malloc(FILE_PERIOD * sizeof(float));
+	}
+	debug(3, "Metering %u channels, %u Hz, %zu frames from %s\n", wav.channels,
+			wav.sample_rate, wav.frames, file_name);
+	// there is no process log to warn through without JACK
+	float period = (float) FILE_PERIOD / wav.sample_rate;
+	if (rms_window / period + 0.5f > RMS_MAX_BLOCKS) {
+		debug(1, "The RMS window is cut to %.3f seconds, %d periods of %d frames\n",
+				RMS_MAX_BLOCKS * period, RMS_MAX_BLOCKS, FILE_PERIOD);
+	}
+	display_info->channels_installed = wav.channels;
+	size_t frame_len = wav.sample_rate / display_info->update_rate;
+	if (frame_len == 0) {
+		frame_len = 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	write_levels_header(out, wav.channels);
+	/*
+	 * Meter whole periods as JACK would, so the ballistics see a steady
+	 * period; the last one is padded with silence.
+	 */
+	size_t frame_end = frame_len;
+	while (first < wav.frames) {
+		size_t n = wav.frames - first;
+		if (n > FILE_PERIOD) {
+			n = FILE_PERIOD;
+		}
+		wav_file_read(&wav, first, n, buffers);
+		for (channel = 0; channel < wav.channels && n < FILE_PERIOD;
+				channel++) {
+			memset(buffers[channel] + n, 0, (FILE_PERIOD - n) * sizeof(float));
+		}
+		meter_period(buffers, FILE_PERIOD);
+		loudness_drain(&loudness);
+		first += n;
+		if (first >= frame_end || first == wav.frames) {
+			display_info->frame_ns = (uint64_t) first * 1000000000ull
+					/ wav.sample_rate;
+			update_levels(display_info);
+			write_levels(out, display_info, (double) first / wav.sample_rate);
+			frame_end += frame_len;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec)
+			+ (end.tv_nsec - start.tv_nsec) * 1e-9;
+	double duration = (double) wav.frames / wav.sample_rate;
+	debug(3, "Metered %.1f seconds of audio in %.3f seconds (%.0f times real time)\n",
+			duration, elapsed, elapsed > 0 ? duration / elapsed : 0.0);
+	if (loudness.channels) {
+		debug(3, "Integrated loudness %.1f LUFS, loudness range %.1f LU\n",
+				loudness_integrated(&loudness), loudness_range(&loudness));
+	}
+
+	if (csv_name) {
+		fclose(out);
+	}
+	for (channel = 0; channel < wav.channels; channel++) {
+		free(buffers[channel]);
+	}
+	loudness_free(&loudness);
+	ballistics_free(&ballistics);
+	channel_store_free(&channel_store);
+	wav_file_close(&wav);
+	return 0;
+}
+
+void init_meter(struct display_info_t *display_info) {
+	memset(display_info, 0, sizeof(struct display_info_t));
+	display_info->update_rate = 8;
+	display_info->bias = 1.0f;
+	lcd_screen_init(&lcd_screen);
+	control_server_init(&control_server);
+	metrics_server_init(&metrics_server);
+}
+
+#ifndef JACKMETER_BENCH
 int main(int argc, char *argv[]) {
 	jack_status_t status;
 	float ref_lev;
 	int opt;
+	char *file_name = NULL;
+	char *csv_name = NULL;
+	unsigned int channels = 0;
 
 	struct display_info_t display_info;
-	memset(&display_info, 0, sizeof(struct display_info_t));
-	display_info.update_rate = 8;
-	display_info.bias = 1.0f;
-
-	// clear channel info
-	memset(channel_info, 0, (MAX_CHANNELS) * sizeof(struct channel_info_t));
+	init_meter(&display_info);
 
 	// Make STDOUT unbuffered
 	setbuf(stdout, NULL);
 	setbuf(stderr, NULL);
 
-	while ((opt = getopt(argc, argv, "d:p:m:s:f:r:l:c:nhv")) != -1) {
+	static const struct option long_options[] = {
+		{ "file", required_argument, NULL, 'w' },
+		{ "csv", required_argument, NULL, 'o' },
+		{ "rms-window", required_argument, NULL, 'W' },
+		{ "hold", required_argument, NULL, 'K' },
+		{ "falloff", required_argument, NULL, 'J' },
+		{ "weights", required_argument, NULL, 'G' },
+		{ "idle-rate", required_argument, NULL, 'F' },
+		{ "socket", required_argument, NULL, 'u' },
+		{ "shm", required_argument, NULL, 'H' },
+		{ "metrics", required_argument, NULL, 'E' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "d:p:m:s:f:F:r:l:c:i:M:T:w:o:D:u:abnLhv",
+			long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'p':
 			peak_char = parse_char(optarg);
@@ -540,6 +1706,10 @@ int main(int argc, char *argv[]) {
 			options |= JackServerName;
 			debug(3, "Setting server name %s\n", server_name);
 			break;
+		case 'D':
+			display_name = copy_malloc(optarg);
+			debug(3, "Setting display %s\n", display_name);
+			break;
 		case 'l':
 			lcd_device = copy_malloc(optarg);
 			debug(3, "Setting lcd_device %s\n", lcd_device);
@@ -551,16 +1721,111 @@ int main(int argc, char *argv[]) {
 			break;
 		case 'f':
 			display_info.update_rate = atoi(optarg);
+			if (display_info.update_rate < 1) {
+				debug(1, "The update rate must be at least 1\n");
+				exit(1);
+			}
 			debug(3, "Updates per second: %d\n", display_info.update_rate);
 			break;
+		case 'F':
+			idle_rate = atoi(optarg);
+			if (idle_rate < 1) {
+				debug(1, "The idle rate must be at least 1\n");
+				exit(1);
+			}
+			debug(3, "Updates per second while idle: %d\n", idle_rate);
+			break;
+		case 'a':
+			debug(3, "Adapting the frames sent to the LCD link\n");
+			adapt_link = 1;
+			break;
+		case 'b':
+			debug(3, "Using glyph bars\n");
+			bar_steps = LCD_CELL_COLUMNS;
+			break;
 		case 'n':
 			debug(3, "Using decibels mode\n");
 			display_info.decibels_mode = 1;
 			break;
+		case 'L':
+			debug(3, "Using loudness mode\n");
+			display_info.decibels_mode = 2;
+			break;
+		case 'G':
+			if (parse_loudness_weights(optarg)) {
+				exit(1);
+			}
+			break;
 		case 'c':
 			debug(3, "Using fifo channel: %s\n", optarg);
+			if (fifo >= 0) {
+				close(fifo);
+			}
 			fifo = make_fifo(optarg);
 			break;
+		case 'u':
+			free_copy(socket_name);
+			socket_name = copy_malloc(optarg);
+			debug(3, "Using control socket: %s\n", socket_name);
+			break;
+		case 'H':
+			free_copy(shm_name);
+			shm_name = copy_malloc(optarg);
+			debug(3, "Publishing levels in shared memory %s\n", shm_name);
+			break;
+		case 'E':
+			free_copy(metrics_address);
+			metrics_address = copy_malloc(optarg);
+			debug(3, "Serving metrics on %s\n", metrics_address);
+			break;
+		case 'i':
+			channels = atoi(optarg);
+			if (channels < 1 || channels > MAX_CHANNELS) {
+				debug(1, "The number of inputs must be from 1 to %d\n",
+						MAX_CHANNELS);
+				exit(1);
+			}
+			debug(3, "Using %d inputs\n", channels);
+			break;
+		case 'T':
+			trace_name = copy_malloc(optarg);
+			debug(3, "Using trace file %s\n", trace_name);
+			break;
+		case 'M':
+			if (parse_meter_modes(optarg)) {
+				exit(1);
+			}
+			break;
+		case 'W':
+			rms_window = atof(optarg);
+			if (rms_window <= 0.0f) {
+				debug(1, "The RMS window must be longer than 0 seconds\n");
+				exit(1);
+			}
+			debug(3, "RMS window: %.3f seconds\n", rms_window);
+			break;
+		case 'K':
+			hold_time = atof(optarg);
+			if (hold_time < 0.0f) {
+				debug(1, "The hold time cannot be negative\n");
+				exit(1);
+			}
+			debug(3, "Peak hold: %.2f seconds\n", hold_time);
+			break;
+		case 'J':
+			hold_falloff = atof(optarg);
+			if (hold_falloff < 0.0f) {
+				debug(1, "The falloff cannot be negative\n");
+				exit(1);
+			}
+			debug(3, "Peak hold falloff: %.1f dB/s\n", hold_falloff);
+			break;
+		case 'w':
+			file_name = copy_malloc(optarg);
+			break;
+		case 'o':
+			csv_name = copy_malloc(optarg);
+			break;
 		case 'h':
 		case 'v':
 		default:
@@ -570,24 +1835,86 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if (!fifo) {
+	if (meter_scale_init(&meter_scale, CONSOLE_WIDTH * bar_steps,
+			display_info.bias)) {
+		debug(1, "Cannot allocate the meter scale.\n");
+		exit(1);
+	}
+
+	// the file analysis meter with the live kernels
+	debug(3, "Using %s peak kernel\n", peak_kernel_init());
+
+	if (file_name) {
+		int result = analyse_file(&display_info, file_name, csv_name);
+		free_copy(file_name);
+		free_copy(csv_name);
+		free(loudness_weights);
+		meter_scale_free(&meter_scale);
+		exit(result);
+	}
+
+	if (trace_name) {
+		trace = fopen(trace_name, "w");
+		if (!trace) {
+			debug(1, "Cannot create trace file %s\n", trace_name);
+			exit(1);
+		}
+	}
+
+	if (fifo < 0) {
 		fifo = make_fifo( DEFAULT_FIFO_NAME);
 	}
-	if (!fifo) {
+	if (fifo < 0) {
 		debug(1, "Unable to open FIFO");
 		exit(1);
 	}
-
-	// ensure we have a device
-	if (!lcd_device) {
-		lcd_device = copy_malloc( DEFAULT_DEVICE);
+	if (socket_name && control_server_open(&control_server, socket_name,
+			run_control, &display_info)) {
+		debug(1, "Cannot listen on the control socket %s: %d\n", socket_name,
+				errno);
+		exit(1);
+	}
+	if (metrics_address && metrics_server_open(&metrics_server,
+			metrics_address, write_metrics, NULL)) {
+		debug(1, "Cannot serve metrics on %s: %d\n", metrics_address, errno);
+		exit(1);
+	}
+#ifndef PROCESS_TIMING
+	// set before the process callback can run, and never changed
+	metrics_process = metrics_address != NULL;
+#endif
+
+	// ensure we have a display
+	const struct display_backend_t *backend = display_name ?
+			display_backend_find(display_name) : display_backends[0];
+	if (backend == NULL) {
+		debug(1, "Unknown display %s, the displays are%s\n", display_name,
+				display_backend_names());
+		exit(1);
+	}
+	if (bar_steps > 1 && backend->compose_glyphs == NULL) {
+		debug(1, "The %s display cannot show the bar glyphs\n", backend->name);
+		exit(1);
+	}
+	const char *target = lcd_device ? lcd_device : backend->default_target;
+	if (display_open(&lcd_display, backend, target)) {
+		debug(1, "Cannot open the %s display %s\n", backend->name,
+				target ? target : "");
+		exit(1);
+	}
+	debug(3, "Using the %s display %s\n", backend->name, target ? target : "");
+	atexit(close_lcd);
+	if (bar_steps > 1) {
+		load_bar_glyphs();
+	}
+	if (lcd_writer_start(&lcd_writer, compose_lcd_frame, write_frame_to_lcd)) {
+		debug(1, "Cannot start the LCD writer.\n");
+		exit(1);
 	}
-	debug(3, "Using LCD %s\n", lcd_device);
-	lcd = open(lcd_device, O_WRONLY);
-	debug(3, "LCD %s opened as %d\n", lcd_device, lcd);
 
 	// ensure the entire display buffer has been cleared
 	clear_display(&display_info);
+	flush_lcd();
 
 	// Register with Jack
 	if ((client = jack_client_open("meter", options, &status, server_name))	== 0) {
@@ -596,13 +1923,42 @@ int main(int argc, char *argv[]) {
 	}
 	debug(3, "Registering as '%s'.\n", jack_get_client_name(client));
 
+	// Without -i there is an input for each port named, and at least two
+	if (channels == 0) {
+		channels = argc - optind;
+		if (channels < DEFAULT_CHANNELS) {
+			channels = DEFAULT_CHANNELS;
+		} else if (channels > MAX_CHANNELS) {
+			channels = MAX_CHANNELS;
+		}
+	}
+	if (channel_store_init(&channel_store, channels)
+			|| ballistics_init(&ballistics, channels,
+					jack_get_sample_rate(client), rms_window)) {
+		debug(1, "Cannot allocate %d channels.\n", channels);
+		exit(1);
+	}
+	set_meter_modes();
+	if (display_info.decibels_mode == 2) {
+		if (loudness_init(&loudness, channels, jack_get_sample_rate(client))) {
+			debug(1, "Cannot allocate the loudness meter.\n");
+			exit(1);
+		}
+		loudness_set_weights(&loudness, loudness_weights,
+				loudness_weight_count);
+		if (loudness_start(&loudness)) {
+			debug(1, "Cannot start the loudness meter.\n");
+			exit(1);
+		}
+	}
+
 	// Create our input ports
 	unsigned int channel;
-	for (channel = 0; channel < MAX_CHANNELS; channel++) {
-		char port_name[10];
+	for (channel = 0; channel < channels; channel++) {
+		char port_name[16];
 		sprintf(port_name, "in_%d", channel);
 		debug(4, "Registering port '%s' on channel %d.\n", port_name, channel);
-		if (!(channel_info[channel].input_port = jack_port_register(client,
+		if (!(channel_store.input_port[channel] = jack_port_register(client,
 				port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0))) {
 			debug(1, "Cannot register input port 'meter:%s'.\n", port_name);
 			exit(1);
@@ -611,9 +1967,36 @@ int main(int argc, char *argv[]) {
 
 	display_info.channels_installed = channels;
 
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0) {
+		debug(1, "Cannot create the wake up event.\n");
+		exit(1);
+	}
+
+	// Create the logs for the JACK callbacks
+	if (rt_log_init(&process_log, RT_LOG_EVENTS, debug_level)
+			|| rt_log_init(&xrun_log, RT_LOG_EVENTS, debug_level)) {
+		debug(1, "Cannot create realtime event logs.\n");
+		exit(1);
+	}
+	if (process_timing_init(&process_timing, jack_get_sample_rate(client))) {
+		debug(1, "Cannot create the process timing ring.\n");
+		exit(1);
+	}
+	// the process timing feeds the metrics, the callback is timed once
+	if (metrics_address) {
+		process_timing.metrics = &metrics.process;
+	}
+
 	// Register the cleanup function to be called when program exits
 	atexit(cleanup);
 
+	if (shm_name && meter_shm_open(&meter_shm, shm_name, channels,
+			jack_get_sample_rate(client))) {
+		debug(1, "Cannot create the shared memory %s: %d\n", shm_name, errno);
+		exit(1);
+	}
+
 	// register the xrun callback
 	jack_set_xrun_callback(client, increment_xrun, &display_info);
 	// Register the peak signal callback
@@ -627,26 +2010,19 @@ int main(int argc, char *argv[]) {
 	// Connect our port to specified port(s)
 	if (argc > optind) {
 
-		channels = 0;
-		while (argc > optind && channels < MAX_CHANNELS) {
-			connect_port(client, argv[optind], channels);
+		channel = 0;
+		while (argc > optind && channel < channels) {
+			connect_port(client, argv[optind], channel);
 			optind++;
-			channel_info[channels].channel = channels;
-			channels++;
+			channel++;
 		}
 	} else {
 		debug(2, "Meter is not connected to a port.\n");
 	}
 
-	// Calculate the decay length (should be 1600ms)
-	decay_len = (int) (1.6f / (1.0f / display_info.update_rate));
-
-	while (check_cmd(&display_info)) {
-		update_display(&display_info);
-		fsleep(1.0f / display_info.update_rate);
-		debug(4, "WOKE UP\n");
-	}
+	run_event_loop(&display_info);
 	clear_display(&display_info);
+	flush_lcd();
 	return 0;
 }
-
+#endif /* JACKMETER_BENCH */
@@ -0,0 +1,117 @@
+/*
+ cuimhne_jackmeter.h
+ Declarations shared by the parts of cuimhne_jackmeter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef CUIMHNE_JACKMETER_H
+#define CUIMHNE_JACKMETER_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include <jack/jack.h>
+
+#include "ballistics.h"
+#include "channel_store.h"
+#include "lcd_screen.h"
+#include "lcd_writer.h"
+#include "display_backend.h"
+#include "loudness.h"
+#include "meter_scale.h"
+
+#define CONSOLE_WIDTH LCD_COLUMNS
+
+/*
+ * Display handling
+ */
+struct display_info_t {
+	int recording;
+	/* incremented by the JACK xrun callback */
+	atomic_int xrun_count;
+	/* the xrun count last shown on the display */
+	int xrun_shown;
+	/* the overs of all the channels last shown on the display */
+	unsigned int overs_shown;
+	int displaying;
+	time_t start_time;
+	time_t elapsed_seconds;
+	int channels_installed;
+	int channels_displaying;
+	/* the channel shown on the first meter row */
+	int first_channel;
+	/* 0 for bar meters, 1 for decibels, 2 for loudness */
+	int decibels_mode;
+	int update_rate;
+	/* the time of the frame being drawn, for the peak holds */
+	uint64_t frame_ns;
+	float bias;
+};
+
+/* written by the LCD writer thread when it is running */
+struct lcd_stats_t {
+	atomic_ulong frames;
+	atomic_ulong syscalls;
+	atomic_ulong bytes;
+	/* for the last frame flushed */
+	int frame_syscalls;
+	int frame_bytes;
+};
+
+extern struct channel_store_t channel_store;
+extern struct ballistics_t ballistics;
+extern struct loudness_t loudness;
+extern struct meter_scale_t meter_scale;
+extern struct lcd_screen_t lcd_screen;
+extern struct lcd_stats_t lcd_stats;
+extern struct lcd_writer_t lcd_writer;
+extern float hold_time;
+extern float hold_falloff;
+/* the display the LCD frames are sent to */
+extern struct display_t lcd_display;
+
+/* DEBUG */
+extern unsigned int debug_level;
+void debug(unsigned int level, const char *fmt, ...)
+		__attribute__((format(printf, 2, 3)));
+
+/*
+ * Set the display defaults and the state everything else needs before any
+ * options are read, for main() and the benchmarks
+ */
+void init_meter(struct display_info_t *display_info);
+
+/*
+ * Meter one period of every channel, buffers[channel] is NULL for a channel
+ * without a port.  This is all the JACK process callback does.
+ */
+void meter_period(float *const *buffers, jack_nframes_t nframes);
+
+/* The JACK xrun callback, arg is the display_info_t */
+int increment_xrun(void *arg);
+
+/* Format the events from the JACK callbacks and show any new xruns */
+void report_rt_events(struct display_info_t *display_info);
+
+/* Take the peaks from the JACK thread and draw the frame on lcd_screen */
+void update_display(struct display_info_t *display_info);
+
+/* Send the changes drawn since the last flush to the LCD */
+void flush_lcd();
+
+#endif /* CUIMHNE_JACKMETER_H */
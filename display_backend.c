@@ -0,0 +1,160 @@
+/*
+ display_backend.c
+ The displays the meter can draw on
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "display_backend.h"
+
+/*
+ * HD44780
+ *
+ * The character device of an HD44780 LCD, such as the Linux charlcd driver,
+ * takes the text and ESC [ row ; column H cursor moves.
+ */
+static int hd44780_init(struct display_t *display, const char *target) {
+	display->fd = open(target, O_WRONLY);
+	return display->fd < 0 ? -1 : 0;
+}
+
+static int escape_compose(struct display_t *display,
+		struct lcd_screen_t *screen, char *out, int size) {
+	return lcd_screen_compose(screen, out, size);
+}
+
+static int escape_glyphs(struct display_t *display, char *out, int size) {
+	return lcd_screen_compose_bar_glyphs(out, size);
+}
+
+static int fd_flush(struct display_t *display, const char *out, int len) {
+	return write(display->fd, out, len);
+}
+
+static void fd_close(struct display_t *display) {
+	if (display->fd >= 0) {
+		close(display->fd);
+	}
+}
+
+static const struct display_backend_t hd44780_backend = {
+	"hd44780", "/dev/lcd0", hd44780_init, escape_compose, escape_glyphs,
+		fd_flush, fd_close
+};
+
+/*
+ * FILE
+ *
+ * The same bytes as the LCD are written to a file, a fifo, stdout for "-",
+ * or a command for a target starting with '|', so a rig without an LCD can
+ * record or check what the meter sends.
+ */
+static int file_init(struct display_t *display, const char *target) {
+	if (!strcmp(target, "-")) {
+		display->fd = STDOUT_FILENO;
+	} else if (target[0] == '|') {
+		display->pipe = popen(target + 1, "w");
+		if (display->pipe == NULL) {
+			return -1;
+		}
+		display->fd = fileno(display->pipe);
+	} else {
+		display->fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	return display->fd < 0 ? -1 : 0;
+}
+
+static void file_close(struct display_t *display) {
+	if (display->pipe) {
+		pclose(display->pipe);
+	} else if (display->fd > STDERR_FILENO) {
+		close(display->fd);
+	}
+}
+
+static const struct display_backend_t file_backend = {
+	"file", "-", file_init, escape_compose, escape_glyphs, fd_flush, file_close
+};
+
+/*
+ * NULL
+ *
+ * Composes the frames and throws them away, for benchmarks and for running
+ * the meter for its other outputs alone.
+ */
+static int null_init(struct display_t *display, const char *target) {
+	return 0;
+}
+
+static int null_flush(struct display_t *display, const char *out, int len) {
+	return len;
+}
+
+static void null_close(struct display_t *display) {
+}
+
+static const struct display_backend_t null_backend = {
+	"null", NULL, null_init, escape_compose, escape_glyphs,
+		null_flush, null_close
+};
+
+const struct display_backend_t *const display_backends[] = {
+	&hd44780_backend,
+#ifdef HAVE_NCURSES
+	&curses_backend,
+#endif
+	&file_backend,
+	&null_backend,
+	NULL
+};
+
+const struct display_backend_t* display_backend_find(const char *name) {
+	int i;
+	for (i = 0; display_backends[i]; i++) {
+		if (!strcmp(name, display_backends[i]->name)) {
+			return display_backends[i];
+		}
+	}
+	return NULL;
+}
+
+int display_open(struct display_t *display,
+		const struct display_backend_t *backend, const char *target) {
+	memset(display, 0, sizeof(struct display_t));
+	display->backend = backend;
+	display->fd = -1;
+	if (target == NULL) {
+		target = backend->default_target;
+	}
+	if (backend->init(display, target)) {
+		display->backend = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void display_close(struct display_t *display) {
+	if (display->backend) {
+		display->backend->close(display);
+		display->backend = NULL;
+	}
+}
@@ -0,0 +1,98 @@
+/*
+ display_backend.h
+ The displays the meter can draw on
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef DISPLAY_BACKEND_H
+#define DISPLAY_BACKEND_H
+
+#include <stdio.h>
+
+#include "lcd_screen.h"
+
+/* The most bytes any backend composes for a frame */
+#define DISPLAY_FRAME_SIZE LCD_FRAME_SIZE
+
+struct display_t;
+
+/*
+ * A backend turns the screen into whatever its display takes.  compose and
+ * flush are called on the LCD writer thread once it is running, init and
+ * close on the main thread before and after it.
+ */
+struct display_backend_t {
+	const char *name;
+	/* the target used when -l is not given, NULL if the backend has none */
+	const char *default_target;
+	/**
+	 * open the display.
+	 * @param target the device, file or command from -l
+	 * @return 0 on success, -1 on failure
+	 */
+	int (*init)(struct display_t *display, const char *target);
+	/**
+	 * write what brings the display up to date with the screen into out.
+	 * @param size at least DISPLAY_FRAME_SIZE
+	 * @return the number of bytes written to out
+	 */
+	int (*compose)(struct display_t *display, struct lcd_screen_t *screen,
+			char *out, int size);
+	/**
+	 * write what loads the bar glyphs into the display into out, NULL if the
+	 * display cannot show them.
+	 * @param size at least LCD_GLYPHS_SIZE
+	 * @return the number of bytes written to out
+	 */
+	int (*compose_glyphs)(struct display_t *display, char *out, int size);
+	/**
+	 * send a composed frame to the display.
+	 * @return the number of bytes sent, or -1 on failure
+	 */
+	int (*flush)(struct display_t *display, const char *out, int len);
+	void (*close)(struct display_t *display);
+};
+
+struct display_t {
+	const struct display_backend_t *backend;
+	int fd;
+	FILE *pipe;
+	void *state;
+};
+
+/* The backends compiled in, terminated by NULL, the first is the default */
+extern const struct display_backend_t *const display_backends[];
+
+/* The backend with a name, or NULL if there is none */
+const struct display_backend_t* display_backend_find(const char *name);
+
+/**
+ * open a display on a backend.
+ * @param target the target, or NULL for the backend's default
+ * @return 0 on success, -1 on failure
+ */
+int display_open(struct display_t *display,
+		const struct display_backend_t *backend, const char *target);
+
+void display_close(struct display_t *display);
+
+#ifdef HAVE_NCURSES
+extern const struct display_backend_t curses_backend;
+#endif
+
+#endif /* DISPLAY_BACKEND_H */
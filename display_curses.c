@@ -0,0 +1,78 @@
+/*
+ display_curses.c
+ An LCD sized view of the meter in a terminal
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include "config.h"
+
+#ifdef HAVE_NCURSES
+
+#include <curses.h>
+
+#include "display_backend.h"
+
+/*
+ * The LCD is drawn in a box at the top left of the terminal.  curses works
+ * out its own updates, so the frame is just the rows that changed.
+ */
+static int curses_init(struct display_t *display, const char *target) {
+	WINDOW *frame;
+	if (initscr() == NULL) {
+		return -1;
+	}
+	noecho();
+	curs_set(0);
+	refresh();
+	frame = newwin(LCD_ROWS + 2, LCD_COLUMNS + 2, 0, 0);
+	if (frame == NULL) {
+		endwin();
+		return -1;
+	}
+	box(frame, 0, 0);
+	wrefresh(frame);
+	display->state = frame;
+	return 0;
+}
+
+static int curses_compose(struct display_t *display,
+		struct lcd_screen_t *screen, char *out, int size) {
+	return lcd_screen_compose_rows(screen, out, size);
+}
+
+static int curses_flush(struct display_t *display, const char *out, int len) {
+	WINDOW *frame = (WINDOW*) display->state;
+	int i;
+	for (i = 0; i + LCD_ROW_RECORD_SIZE <= len; i += LCD_ROW_RECORD_SIZE) {
+		mvwaddnstr(frame, out[i], 1, &out[i + 1], LCD_COLUMNS);
+	}
+	wrefresh(frame);
+	return len;
+}
+
+static void curses_close(struct display_t *display) {
+	delwin((WINDOW*) display->state);
+	endwin();
+}
+
+const struct display_backend_t curses_backend = {
+	"curses", NULL, curses_init, curses_compose, NULL, curses_flush,
+		curses_close
+};
+
+#endif /* HAVE_NCURSES */
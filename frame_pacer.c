@@ -0,0 +1,56 @@
+/*
+ frame_pacer.c
+ Drawing the display at the full rate only while the levels are moving
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <string.h>
+
+#include "frame_pacer.h"
+
+void frame_pacer_init(struct frame_pacer_t *pacer, int update_rate,
+		int idle_rate) {
+	memset(pacer, 0, sizeof(struct frame_pacer_t));
+	pacer->update_rate = update_rate;
+	if (idle_rate > 0 && idle_rate < update_rate) {
+		pacer->idle_divisor = update_rate / idle_rate;
+		pacer->fast_frames = update_rate * FRAME_PACER_HOLD_SECONDS;
+	}
+}
+
+int frame_pacer_due(struct frame_pacer_t *pacer, int frames, int transient,
+		int full) {
+	if (pacer->idle_divisor == 0) {
+		return 1;
+	}
+	if (transient) {
+		if (pacer->fast_frames <= 0) {
+			pacer->wakes++;
+		}
+		pacer->fast_frames = pacer->update_rate * FRAME_PACER_HOLD_SECONDS;
+	} else if (pacer->fast_frames > 0) {
+		pacer->fast_frames -= frames;
+	}
+	pacer->pending += frames;
+	if (!full && !transient && pacer->fast_frames <= 0
+			&& pacer->pending < pacer->idle_divisor) {
+		return 0;
+	}
+	pacer->pending = 0;
+	return 1;
+}
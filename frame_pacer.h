@@ -0,0 +1,74 @@
+/*
+ frame_pacer.h
+ Drawing the display at the full rate only while the levels are moving
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+/* a transient keeps the display at the full rate for this long */
+#define FRAME_PACER_HOLD_SECONDS 1
+
+/*
+ * The frame timer always runs at the update rate, and at every tick the main
+ * loop looks at the levels waiting for the display without taking them.  A
+ * level that would raise what the display shows is a transient: it is drawn
+ * at once and the display is drawn at the full rate for
+ * FRAME_PACER_HOLD_SECONDS after it.
+ * Otherwise, when the levels are steady, only falling or nothing is shown,
+ * the display is drawn at the idle rate.  The peaks keep rising between
+ * the frames drawn, so none is missed, and the peak holds go by the time of
+ * each frame, so they keep their time.
+ */
+struct frame_pacer_t {
+	int update_rate;
+	/* one frame in idle_divisor is drawn while idle, 0 when not adapting */
+	int idle_divisor;
+	/* the frames left at the full rate */
+	int fast_frames;
+	/* the timer ticks since the last frame drawn */
+	int pending;
+	/* the transients that brought back the full rate */
+	unsigned long wakes;
+};
+
+/**
+ * start pacing the display.
+ * @param idle_rate the frames per second drawn while the levels are steady,
+ * 0 to draw every frame
+ */
+void frame_pacer_init(struct frame_pacer_t *pacer, int update_rate,
+		int idle_rate);
+
+/**
+ * decide whether to draw this frame.
+ * @param frames the frame timer ticks since the last call
+ * @param transient a displayed level has risen since the last frame drawn
+ * @param full the display must be drawn at the full rate, for subscribers
+ * @return 1 to draw the frame
+ */
+int frame_pacer_due(struct frame_pacer_t *pacer, int frames, int transient,
+		int full);
+
+/* Whether the display is drawn at the full rate */
+static inline int frame_pacer_fast(const struct frame_pacer_t *pacer) {
+	return pacer->idle_divisor == 0 || pacer->fast_frames > 0;
+}
+
+#endif /* FRAME_PACER_H */
@@ -0,0 +1,117 @@
+/*
+ jackmeter_shm.h
+ The shared memory snapshot of the meter, for programs that read it
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef JACKMETER_SHM_H
+#define JACKMETER_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/*
+ * With --shm name the meter creates the POSIX shared memory object name and
+ * updates it at the end of every JACK period.  A reader maps it read only:
+ *
+ *   int fd = shm_open("/jack_meter", O_RDONLY, 0);
+ *   struct stat st;
+ *   fstat(fd, &st);
+ *   const struct jackmeter_shm_t *shm = mmap(NULL, st.st_size, PROT_READ,
+ *           MAP_SHARED, fd, 0);
+ *
+ * and then takes snapshots with jackmeter_shm_snapshot() as often as it
+ * likes.  The segment is a seqlock: the JACK thread makes sequence odd while
+ * it writes the channels and even again when it is done, and never waits
+ * for a reader, so a reader copies the channels and tries again if sequence
+ * was odd or moved meanwhile.  Reading takes no system calls and no locks.
+ *
+ * Fields are in the byte order of the host.  The segment is removed when
+ * the meter exits; a reader that keeps it mapped sees the last snapshot.
+ */
+#define JACKMETER_SHM_MAGIC 0x4a4d5348
+#define JACKMETER_SHM_VERSION 1
+
+struct jackmeter_shm_channel_t {
+	/* the sample peak of the last period, 1 is full scale */
+	float peak;
+	/* the RMS over the -W window */
+	float rms;
+	/*
+	 * the peak hold of the level the display shows, held for --hold seconds
+	 * and then falling at the --falloff rate, updated every display frame
+	 */
+	float hold;
+	/* overs and full scale samples since the counters were last reset */
+	uint32_t overs;
+	uint32_t clipped;
+	uint32_t reserved[3];
+};
+
+struct jackmeter_shm_t {
+	/* set before the segment is first published, never change */
+	uint32_t magic;
+	uint32_t version;
+	/* the size of the segment and the number of channels in it */
+	uint32_t size;
+	uint32_t channels;
+	uint32_t sample_rate;
+	/* odd while the JACK thread writes the fields below */
+	_Atomic uint32_t sequence;
+	/* periods and frames metered since the meter started */
+	uint64_t periods;
+	uint64_t frames;
+	/* xruns since the meter started, outside the seqlock */
+	_Atomic uint32_t xruns;
+	uint32_t reserved;
+	struct jackmeter_shm_channel_t channel[];
+};
+
+/**
+ * copy the channels of a consistent snapshot.
+ * @param out room for count channels, at most shm->channels are copied
+ * @param periods set to the periods metered at the snapshot if not NULL
+ * @return the sequence of the snapshot, it only changes when there is a new
+ * one
+ */
+static inline uint32_t jackmeter_shm_snapshot(
+		const struct jackmeter_shm_t *shm,
+		struct jackmeter_shm_channel_t *out, uint32_t count,
+		uint64_t *periods) {
+	uint32_t before;
+	uint32_t after;
+	uint64_t metered;
+	if (count > shm->channels) {
+		count = shm->channels;
+	}
+	do {
+		before = atomic_load_explicit(&shm->sequence, memory_order_acquire);
+		memcpy(out, (const void*) shm->channel,
+				count * sizeof(struct jackmeter_shm_channel_t));
+		metered = shm->periods;
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&shm->sequence, memory_order_relaxed);
+	} while ((before & 1) || before != after);
+	if (periods) {
+		*periods = metered;
+	}
+	return before;
+}
+
+#endif /* JACKMETER_SHM_H */
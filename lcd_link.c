@@ -0,0 +1,80 @@
+/*
+ lcd_link.c
+ How busy the link to the LCD is, and sending fewer frames when it is full
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <string.h>
+
+#include "lcd_link.h"
+
+void lcd_link_init(struct lcd_link_t *link, int adapt, int update_rate,
+		uint64_t now_ns) {
+	memset(link, 0, sizeof(struct lcd_link_t));
+	link->adapt = adapt;
+	link->divisor = 1;
+	link->max_divisor = update_rate > 1 ? update_rate : 1;
+	link->window_start = now_ns;
+}
+
+int lcd_link_update(struct lcd_link_t *link, uint64_t now_ns, uint64_t bytes,
+		uint64_t busy_ns, uint64_t behind) {
+	uint64_t wall = now_ns - link->window_start;
+	if (wall < LCD_LINK_WINDOW_NS) {
+		return 0;
+	}
+	uint64_t written = bytes - link->bytes;
+	uint64_t busy = busy_ns - link->busy_ns;
+	uint64_t late = behind - link->behind;
+	link->window_start = now_ns;
+	link->bytes = bytes;
+	link->busy_ns = busy_ns;
+	link->behind = behind;
+
+	link->busy = (double) busy / wall;
+	if (busy > 0 && written > 0) {
+		double throughput = written * 1e9 / busy;
+		link->throughput = link->throughput > 0.0 ?
+				0.75 * link->throughput + 0.25 * throughput : throughput;
+	}
+	if (!link->adapt) {
+		return 0;
+	}
+	if ((link->busy > LCD_LINK_SATURATED || late > 0)
+			&& link->divisor < link->max_divisor) {
+		link->divisor *= 2;
+		if (link->divisor > link->max_divisor) {
+			link->divisor = link->max_divisor;
+		}
+		link->slowdowns++;
+		return 1;
+	}
+	if (link->busy < LCD_LINK_IDLE && late == 0 && link->divisor > 1) {
+		link->divisor /= 2;
+		return 1;
+	}
+	return 0;
+}
+
+int lcd_link_frame_due(struct lcd_link_t *link) {
+	if (++link->frame >= (unsigned int) link->divisor) {
+		link->frame = 0;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ lcd_link.h
+ How busy the link to the LCD is, and sending fewer frames when it is full
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef LCD_LINK_H
+#define LCD_LINK_H
+
+#include <stdint.h>
+
+/* the link is measured over windows of this length */
+#define LCD_LINK_WINDOW_NS 1000000000ull
+/* the share of a window spent writing above which the link is saturated */
+#define LCD_LINK_SATURATED 0.8
+/*
+ * the share below which twice the frames can be sent again, less than half
+ * of LCD_LINK_SATURATED so the rate does not swing back and forth
+ */
+#define LCD_LINK_IDLE 0.3
+
+/*
+ * The main loop measures the link from the totals the LCD writer keeps: the
+ * bytes it wrote, the time it spent writing them, and the frames it fell
+ * behind on.  Bytes over write time is the throughput the LCD actually
+ * takes, an I2C backpack being far slower than its bus clock suggests, and
+ * write time over wall time is how much of the link the meter uses.
+ *
+ * When adapting, a saturated link, or a writer that dropped or merged
+ * frames, halves the frames sent, down to one a second, and a link that
+ * has become idle doubles them again up to the update rate.  The meter
+ * itself is still updated at every frame, only the sending is thinned, so
+ * the peak hold keeps its time and the LCD shows the latest levels rather
+ * than a queue of old ones.
+ */
+struct lcd_link_t {
+	int adapt;
+	/* one frame in divisor is sent, from 1 to max_divisor */
+	int divisor;
+	int max_divisor;
+	unsigned int frame;
+
+	/* the totals at the start of the window */
+	uint64_t window_start;
+	uint64_t bytes;
+	uint64_t busy_ns;
+	uint64_t behind;
+
+	/* bytes a second of write time, smoothed over the windows */
+	double throughput;
+	/* the share of the last window spent writing */
+	double busy;
+	/* the times the frames sent were halved */
+	unsigned long slowdowns;
+};
+
+/**
+ * start measuring the link.
+ * @param adapt whether to thin the frames sent when the link is saturated
+ * @param update_rate the display frames per second
+ */
+void lcd_link_init(struct lcd_link_t *link, int adapt, int update_rate,
+		uint64_t now_ns);
+
+/**
+ * end the window once it is long enough and adapt the frames sent to it,
+ * called at every display frame.
+ * @param bytes the bytes written to the LCD so far
+ * @param busy_ns the time spent writing them
+ * @param behind the frames the LCD writer dropped or merged so far
+ * @return 1 if the frames sent changed
+ */
+int lcd_link_update(struct lcd_link_t *link, uint64_t now_ns, uint64_t bytes,
+		uint64_t busy_ns, uint64_t behind);
+
+/* Whether this display frame is to be sent, called at every display frame */
+int lcd_link_frame_due(struct lcd_link_t *link);
+
+#endif /* LCD_LINK_H */
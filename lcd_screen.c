@@ -0,0 +1,201 @@
+/*
+ lcd_screen.c
+ Shadow of the LCD contents and differential updates
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <string.h>
+
+#include "lcd_screen.h"
+
+#define ROW_BIT(row) (1u << ((row) - 1))
+
+void lcd_screen_init(struct lcd_screen_t *screen) {
+	memset(screen, 0, sizeof(struct lcd_screen_t));
+	memset(screen->text, ' ', sizeof(screen->text));
+	screen->differential = 1;
+}
+
+void lcd_screen_invalidate(struct lcd_screen_t *screen) {
+	screen->shown_rows = 0;
+}
+
+void lcd_screen_draw(struct lcd_screen_t *screen, int row, int column,
+		const char *text, int len) {
+	if (row < 1 || row > LCD_ROWS || column < 0 || column >= LCD_COLUMNS) {
+		return;
+	}
+	if (len > LCD_COLUMNS - column) {
+		len = LCD_COLUMNS - column;
+	}
+	memcpy(&screen->text[row - 1][column], text, len * sizeof(char));
+	screen->used_rows |= ROW_BIT(row);
+	screen->drawn_rows |= ROW_BIT(row);
+}
+
+void lcd_screen_clear(struct lcd_screen_t *screen, int first, int last) {
+	int row;
+	for (row = first; row <= last && row <= LCD_ROWS; row++) {
+		if (row >= 1) {
+			memset(screen->text[row - 1], ' ', LCD_COLUMNS * sizeof(char));
+			screen->used_rows |= ROW_BIT(row);
+			screen->drawn_rows |= ROW_BIT(row);
+		}
+	}
+}
+
+static int move_cursor(char *out, int row, int column) {
+	out[0] = ESC;
+	out[1] = '[';
+	out[2] = '0' + row;
+	out[3] = ';';
+	out[4] = '0' + column;
+	out[5] = 'H';
+	return CURSOR_MOVE_SIZE;
+}
+
+/* Send the whole of a row */
+static int compose_full_row(struct lcd_screen_t *screen, int row, char *out) {
+	int len = move_cursor(out, row, 0);
+	memcpy(&out[len], screen->text[row - 1], LCD_COLUMNS * sizeof(char));
+	memcpy(screen->shown[row - 1], screen->text[row - 1],
+			LCD_COLUMNS * sizeof(char));
+	return LCD_ROW_SIZE;
+}
+
+/*
+ * Send the changed characters of a row.  Two changes closer together than a
+ * cursor move are sent as one run, and a run that starts past the last
+ * addressable column starts at that column instead.  Scattered changes can
+ * cost more than the whole row, which is then sent instead, so a row never
+ * takes more than LCD_ROW_SIZE bytes.
+ */
+static int compose_row(struct lcd_screen_t *screen, int row, char *out) {
+	const char *text = screen->text[row - 1];
+	char *shown = screen->shown[row - 1];
+	int len = 0;
+	int column = 0;
+	while (column < LCD_COLUMNS) {
+		if (text[column] == shown[column]) {
+			column++;
+			continue;
+		}
+		int start = column < MAX_CURSOR_COLUMN ? column : MAX_CURSOR_COLUMN;
+		int end = column + 1;
+		int next;
+		for (next = end; next < LCD_COLUMNS && next - end <= CURSOR_MOVE_SIZE;
+				next++) {
+			if (text[next] != shown[next]) {
+				end = next + 1;
+			}
+		}
+		if (len + CURSOR_MOVE_SIZE + end - start > LCD_ROW_SIZE) {
+			return compose_full_row(screen, row, out);
+		}
+		len += move_cursor(&out[len], row, start);
+		memcpy(&out[len], &text[start], (end - start) * sizeof(char));
+		len += end - start;
+		column = end;
+	}
+	memcpy(shown, text, LCD_COLUMNS * sizeof(char));
+	return len;
+}
+
+int lcd_screen_compose(struct lcd_screen_t *screen, char *out, int size) {
+	int len = 0;
+	int row;
+	if (size < LCD_FRAME_SIZE) {
+		return 0;
+	}
+	for (row = 1; row <= LCD_ROWS; row++) {
+		unsigned int bit = ROW_BIT(row);
+		if (!(screen->used_rows & bit)) {
+			continue;
+		}
+		if (!(screen->shown_rows & bit)) {
+			// the display contents are unknown
+			len += compose_full_row(screen, row, &out[len]);
+			screen->shown_rows |= bit;
+		} else if (!screen->differential) {
+			if (screen->drawn_rows & bit) {
+				len += compose_full_row(screen, row, &out[len]);
+			}
+		} else {
+			len += compose_row(screen, row, &out[len]);
+		}
+	}
+	screen->drawn_rows = 0;
+	return len;
+}
+
+int lcd_screen_compose_rows(struct lcd_screen_t *screen, char *out, int size) {
+	int len = 0;
+	int row;
+	if (size < LCD_ROWS * LCD_ROW_RECORD_SIZE) {
+		return 0;
+	}
+	for (row = 1; row <= LCD_ROWS; row++) {
+		unsigned int bit = ROW_BIT(row);
+		char *text = screen->text[row - 1];
+		if (!(screen->used_rows & bit)) {
+			continue;
+		}
+		if (screen->shown_rows & bit) {
+			int changed = screen->differential ?
+					memcmp(text, screen->shown[row - 1],
+							LCD_COLUMNS * sizeof(char)) != 0 :
+					(screen->drawn_rows & bit) != 0;
+			if (!changed) {
+				continue;
+			}
+		}
+		out[len++] = (char) row;
+		memcpy(&out[len], text, LCD_COLUMNS * sizeof(char));
+		memcpy(screen->shown[row - 1], text, LCD_COLUMNS * sizeof(char));
+		len += LCD_COLUMNS;
+		screen->shown_rows |= bit;
+	}
+	screen->drawn_rows = 0;
+	return len;
+}
+
+int lcd_screen_compose_bar_glyphs(char *out, int size) {
+	static const char hex[] = "0123456789abcdef";
+	int len = 0;
+	int columns;
+	int row;
+	if (size < LCD_GLYPHS_SIZE) {
+		return 0;
+	}
+	for (columns = 1; columns <= LCD_CELL_COLUMNS; columns++) {
+		// bit 4 is the left column, the bottom row is left for the cursor
+		unsigned int pixels = (0x1fu << (LCD_CELL_COLUMNS - columns)) & 0x1fu;
+		out[len++] = ESC;
+		out[len++] = '[';
+		out[len++] = 'L';
+		out[len++] = 'G';
+		out[len++] = '0' + LCD_BAR_GLYPH(columns);
+		for (row = 0; row < LCD_CELL_ROWS; row++) {
+			unsigned int bits = row < LCD_CELL_ROWS - 1 ? pixels : 0;
+			out[len++] = hex[bits >> 4];
+			out[len++] = hex[bits & 0xf];
+		}
+		out[len++] = ';';
+	}
+	return len;
+}
@@ -0,0 +1,117 @@
+/*
+ lcd_screen.h
+ Shadow of the LCD contents and differential updates
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef LCD_SCREEN_H
+#define LCD_SCREEN_H
+
+/* The display is 4 rows of 20 characters, rows are numbered from 1 */
+#define LCD_ROWS 4
+#define LCD_COLUMNS 20
+
+#define ESC (char)0x1b
+/* ESC [ row ; column H */
+#define CURSOR_MOVE_SIZE 6
+/* the driver takes a single digit column in the cursor move */
+#define MAX_CURSOR_COLUMN 9
+/* the bytes that send a whole row, the most a row is ever sent as */
+#define LCD_ROW_SIZE (CURSOR_MOVE_SIZE + LCD_COLUMNS)
+/* the most bytes lcd_screen_compose() writes */
+#define LCD_FRAME_SIZE (LCD_ROWS * LCD_ROW_SIZE)
+
+/*
+ * The meter draws into text, the contents it wants on the display, and
+ * lcd_screen_compose() works out the bytes that bring the display from shown
+ * to text.  Only rows the meter has drawn on are ever sent, the other rows
+ * belong to whoever else uses the display.
+ */
+struct lcd_screen_t {
+	char text[LCD_ROWS][LCD_COLUMNS];
+	/* what the display is showing, valid for the rows in shown_rows */
+	char shown[LCD_ROWS][LCD_COLUMNS];
+	/* bit masks of rows, bit 0 is row 1 */
+	unsigned int used_rows;
+	unsigned int drawn_rows;
+	unsigned int shown_rows;
+	/* when zero every row drawn on is sent in full */
+	int differential;
+};
+
+void lcd_screen_init(struct lcd_screen_t *screen);
+
+/*
+ * Forget what the display shows so the next compose sends every used row, for
+ * when the display took only part of a frame or its glyphs were reloaded.
+ */
+void lcd_screen_invalidate(struct lcd_screen_t *screen);
+
+/**
+ * place text on the screen, text past the end of the row is dropped.
+ * @param row the row from 1 to LCD_ROWS
+ * @param column the column from 0
+ */
+void lcd_screen_draw(struct lcd_screen_t *screen, int row, int column,
+		const char *text, int len);
+
+/* Blank the rows from first to last inclusive */
+void lcd_screen_clear(struct lcd_screen_t *screen, int first, int last);
+
+/**
+ * write the cursor moves and characters that update the display into out.
+ * The screen then considers them shown.
+ * @param out the buffer for the update
+ * @param size the size of out, at least LCD_FRAME_SIZE
+ * @return the number of bytes written to out
+ */
+int lcd_screen_compose(struct lcd_screen_t *screen, char *out, int size);
+
+/*
+ * The bar glyphs fill the left 1 to LCD_CELL_COLUMNS pixel columns of a cell,
+ * so a bar moves in steps of a pixel column.  They are loaded into the CGRAM
+ * with ESC [ L G code hex ; where hex is 8 bytes of pixel rows.
+ */
+#define LCD_CELL_COLUMNS 5
+#define LCD_CELL_ROWS 8
+/* the character code of the glyph with columns lit */
+#define LCD_BAR_GLYPH(columns) ((char) (columns))
+/* ESC [ L G, the code, 2 hex digits per pixel row and ; */
+#define GLYPH_DEFINE_SIZE (5 + 2 * LCD_CELL_ROWS + 1)
+#define LCD_GLYPHS_SIZE (LCD_CELL_COLUMNS * GLYPH_DEFINE_SIZE)
+
+/**
+ * write the definitions of the bar glyphs into out.
+ * @param size the size of out, at least LCD_GLYPHS_SIZE
+ * @return the number of bytes written to out
+ */
+int lcd_screen_compose_bar_glyphs(char *out, int size);
+
+/* A row of lcd_screen_compose_rows(), the row number then its text */
+#define LCD_ROW_RECORD_SIZE (1 + LCD_COLUMNS)
+
+/**
+ * write the rows that changed as records of the row number, from 1, and the
+ * whole row, for displays that are not driven by cursor moves.  The screen
+ * then considers them shown.
+ * @param size the size of out, at least LCD_ROWS * LCD_ROW_RECORD_SIZE
+ * @return the number of bytes written to out
+ */
+int lcd_screen_compose_rows(struct lcd_screen_t *screen, char *out, int size);
+
+#endif /* LCD_SCREEN_H */
@@ -0,0 +1,142 @@
+/*
+ lcd_writer.c
+ Thread that sends the screen to the LCD
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include "lcd_writer.h"
+
+#define QUEUE_MASK (LCD_WRITER_QUEUE - 1)
+
+static void copy_frame(struct lcd_frame_t *frame,
+		const struct lcd_screen_t *screen) {
+	memcpy(frame->text, screen->text, sizeof(frame->text));
+	frame->used_rows = screen->used_rows;
+	frame->drawn_rows = screen->drawn_rows;
+	frame->differential = screen->differential;
+}
+
+/* Put a frame on the writer's screen, keeping the rows drawn before it */
+static void show_frame(struct lcd_writer_t *writer,
+		const struct lcd_frame_t *frame) {
+	memcpy(writer->screen.text, frame->text, sizeof(frame->text));
+	writer->screen.used_rows |= frame->used_rows;
+	writer->screen.drawn_rows |= frame->drawn_rows;
+	writer->screen.differential = frame->differential;
+}
+
+static void send_screen(struct lcd_writer_t *writer) {
+	char out[LCD_FRAME_SIZE];
+	int len = writer->compose(&writer->screen, out, LCD_FRAME_SIZE);
+	// after a short write what the display shows is unknown
+	if (len > 0 && writer->write(out, len)) {
+		lcd_screen_invalidate(&writer->screen);
+	}
+}
+
+/*
+ * Take every frame queued onto the writer's screen, returns how many there
+ * were.  The rows drawn in the frames skipped are still sent.
+ */
+static unsigned int take_frames(struct lcd_writer_t *writer) {
+	unsigned int tail = atomic_load_explicit(&writer->tail,
+			memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&writer->head,
+			memory_order_acquire);
+	unsigned int frames = head - tail;
+	for (; tail != head; tail++) {
+		show_frame(writer, &writer->queue[tail & QUEUE_MASK]);
+	}
+	atomic_store_explicit(&writer->tail, tail, memory_order_release);
+	return frames;
+}
+
+static void* lcd_writer_thread(void *arg) {
+	struct lcd_writer_t *writer = (struct lcd_writer_t*) arg;
+	int running = 1;
+	while (running) {
+		if (sem_wait(&writer->ready) && errno == EINTR) {
+			continue;
+		}
+		running = atomic_load(&writer->running);
+		unsigned int frames = take_frames(writer);
+		if (frames == 0) {
+			continue;
+		}
+		if (frames > 1) {
+			atomic_fetch_add_explicit(&writer->merged, frames - 1,
+					memory_order_relaxed);
+		}
+		send_screen(writer);
+	}
+	return NULL;
+}
+
+int lcd_writer_start(struct lcd_writer_t *writer,
+		int (*compose)(struct lcd_screen_t *screen, char *out, int size),
+		int (*write)(const char *frame, int len)) {
+	memset(writer, 0, sizeof(struct lcd_writer_t));
+	lcd_screen_init(&writer->screen);
+	writer->compose = compose;
+	writer->write = write;
+	if (sem_init(&writer->ready, 0, 0)) {
+		return -1;
+	}
+	atomic_store(&writer->running, 1);
+	if (pthread_create(&writer->thread, NULL, lcd_writer_thread, writer)) {
+		sem_destroy(&writer->ready);
+		return -1;
+	}
+	writer->started = 1;
+	return 0;
+}
+
+void lcd_writer_stop(struct lcd_writer_t *writer,
+		const struct lcd_screen_t *screen) {
+	struct lcd_frame_t frame;
+	if (!writer->started) {
+		return;
+	}
+	atomic_store(&writer->running, 0);
+	sem_post(&writer->ready);
+	pthread_join(writer->thread, NULL);
+	sem_destroy(&writer->ready);
+	writer->started = 0;
+	copy_frame(&frame, screen);
+	show_frame(writer, &frame);
+	send_screen(writer);
+}
+
+int lcd_writer_post(struct lcd_writer_t *writer,
+		const struct lcd_screen_t *screen) {
+	unsigned int head = atomic_load_explicit(&writer->head,
+			memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&writer->tail,
+			memory_order_acquire);
+	if (head - tail >= LCD_WRITER_QUEUE) {
+		atomic_fetch_add_explicit(&writer->dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+	copy_frame(&writer->queue[head & QUEUE_MASK], screen);
+	atomic_store_explicit(&writer->head, head + 1, memory_order_release);
+	sem_post(&writer->ready);
+	return 0;
+}
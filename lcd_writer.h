@@ -0,0 +1,101 @@
+/*
+ lcd_writer.h
+ Thread that sends the screen to the LCD
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef LCD_WRITER_H
+#define LCD_WRITER_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "lcd_screen.h"
+
+/* screens queued for the writer, a power of 2 */
+#define LCD_WRITER_QUEUE 4
+
+/* What the main loop wants on the display at one flush */
+struct lcd_frame_t {
+	char text[LCD_ROWS][LCD_COLUMNS];
+	unsigned int used_rows;
+	unsigned int drawn_rows;
+	int differential;
+};
+
+/*
+ * The main loop queues a copy of its screen at each flush, and the writer
+ * thread takes the newest one queued and sends what changed since the last
+ * one it sent.  Every frame is the whole screen, so a frame left out is
+ * simply replaced by the next: when the queue is full the main loop drops
+ * its frame and sends a newer one at the next flush, and when the writer
+ * finds several frames queued it sends only the newest.  A stalled LCD
+ * therefore never holds up the main loop.
+ *
+ * The queue has a single producer and a single consumer; head is only
+ * written by the main loop and tail by the writer.
+ */
+struct lcd_writer_t {
+	struct lcd_frame_t queue[LCD_WRITER_QUEUE];
+	atomic_uint head;
+	atomic_uint tail;
+
+	/* the writer's view of the display, its shown rows are what was sent */
+	struct lcd_screen_t screen;
+	int (*compose)(struct lcd_screen_t *screen, char *out, int size);
+	int (*write)(const char *frame, int len);
+
+	int started;
+	atomic_int running;
+	pthread_t thread;
+	sem_t ready;
+
+	/* frames the main loop could not queue, and frames the writer skipped */
+	atomic_ulong dropped;
+	atomic_ulong merged;
+};
+
+/**
+ * start the writer thread.
+ * @param compose composes a frame from the writer's screen, as
+ * lcd_screen_compose() does, called on the writer thread
+ * @param write sends a composed frame to the LCD, called on the writer thread,
+ * and returns 0 when the whole frame was written
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int lcd_writer_start(struct lcd_writer_t *writer,
+		int (*compose)(struct lcd_screen_t *screen, char *out, int size),
+		int (*write)(const char *frame, int len));
+
+/**
+ * stop the thread, then bring the display up to date with the screen, which
+ * may be newer than the last frame queued.
+ */
+void lcd_writer_stop(struct lcd_writer_t *writer,
+		const struct lcd_screen_t *screen);
+
+/**
+ * queue a copy of the screen for the writer.
+ * @return 0 if the frame was queued, -1 if the queue was full and the frame
+ * was dropped
+ */
+int lcd_writer_post(struct lcd_writer_t *writer,
+		const struct lcd_screen_t *screen);
+
+#endif /* LCD_WRITER_H */
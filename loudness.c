@@ -0,0 +1,398 @@
+/*
+ loudness.c
+ EBU R128 / ITU-R BS.1770 loudness meter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "loudness.h"
+#include "channel_store.h"
+
+/* BS.1770 K-weighting, the stage 1 high shelf */
+#define SHELF_FREQUENCY 1681.974450955533
+#define SHELF_GAIN_DB 3.999843853973347
+#define SHELF_Q 0.7071752369554196
+/* and the stage 2 high pass */
+#define HIGH_PASS_FREQUENCY 38.13547087602444
+#define HIGH_PASS_Q 0.5003270373238773
+
+/* the relative gates of the integrated loudness and loudness range */
+#define INTEGRATED_GATE_LU -10.0f
+#define RANGE_GATE_LU -20.0f
+
+/* filter state this small is flushed so silence never runs on denormals */
+#define FILTER_FLOOR 1e-30
+
+/* Work out the coefficients of the two K-weighting stages for a sample rate */
+static void k_weighting_coefficients(double coeff[2][5], double sample_rate) {
+	double k = tan(M_PI * SHELF_FREQUENCY / sample_rate);
+	double vh = pow(10.0, SHELF_GAIN_DB / 20.0);
+	double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / SHELF_Q + k * k;
+	coeff[0][0] = (vh + vb * k / SHELF_Q + k * k) / a0;
+	coeff[0][1] = 2.0 * (k * k - vh) / a0;
+	coeff[0][2] = (vh - vb * k / SHELF_Q + k * k) / a0;
+	coeff[0][3] = 2.0 * (k * k - 1.0) / a0;
+	coeff[0][4] = (1.0 - k / SHELF_Q + k * k) / a0;
+
+	k = tan(M_PI * HIGH_PASS_FREQUENCY / sample_rate);
+	a0 = 1.0 + k / HIGH_PASS_Q + k * k;
+	coeff[1][0] = 1.0;
+	coeff[1][1] = -2.0;
+	coeff[1][2] = 1.0;
+	coeff[1][3] = 2.0 * (k * k - 1.0) / a0;
+	coeff[1][4] = (1.0 - k / HIGH_PASS_Q + k * k) / a0;
+}
+
+static inline float energy_to_lufs(double energy) {
+	return energy > 0.0 ? -0.691f + 10.0f * log10f(energy) : -INFINITY;
+}
+
+static inline void publish(_Atomic uint32_t *slot, float value) {
+	atomic_store_explicit(slot, peak_to_bits(value), memory_order_relaxed);
+}
+
+static inline float published(_Atomic uint32_t *slot) {
+	return bits_to_peak(atomic_load_explicit(slot, memory_order_relaxed));
+}
+
+int loudness_init(struct loudness_t *loudness, unsigned int channels,
+		float sample_rate) {
+	unsigned int bin;
+	memset(loudness, 0, sizeof(struct loudness_t));
+	loudness->channels = channels;
+	loudness->sample_rate = sample_rate;
+	loudness->block_frames = (unsigned int) (sample_rate
+			/ LOUDNESS_BLOCKS_PER_SECOND + 0.5f);
+	if (loudness->block_frames == 0) {
+		loudness->block_frames = 1;
+	}
+	k_weighting_coefficients(loudness->coeff, sample_rate);
+	for (bin = 0; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+		float centre = LOUDNESS_HISTOGRAM_MIN + (bin + 0.5f) * 0.1f;
+		loudness->bin_energy[bin] = pow(10.0, (centre + 0.691) / 10.0);
+	}
+	publish(&loudness->momentary, -INFINITY);
+	publish(&loudness->short_term, -INFINITY);
+	publish(&loudness->integrated, -INFINITY);
+	publish(&loudness->range, 0.0f);
+
+	loudness->weight = malloc(channels * sizeof(float));
+	loudness->filter = calloc(channels, sizeof(struct k_filter_t));
+	loudness->momentary_histogram = calloc(LOUDNESS_HISTOGRAM_BINS,
+			sizeof(unsigned long));
+	loudness->short_term_histogram = calloc(LOUDNESS_HISTOGRAM_BINS,
+			sizeof(unsigned long));
+	loudness->blocks = jack_ringbuffer_create(
+			LOUDNESS_QUEUE_BLOCKS * sizeof(double));
+	if (!loudness->weight || !loudness->filter
+			|| !loudness->momentary_histogram
+			|| !loudness->short_term_histogram || !loudness->blocks) {
+		loudness_free(loudness);
+		return -1;
+	}
+	// keep the queue out of swap so the JACK thread never faults on it
+	jack_ringbuffer_mlock(loudness->blocks);
+	loudness_set_weights(loudness, NULL, 0);
+	return 0;
+}
+
+void loudness_free(struct loudness_t *loudness) {
+	if (loudness->threaded) {
+		atomic_store(&loudness->running, 0);
+		sem_post(&loudness->ready);
+		pthread_join(loudness->worker, NULL);
+		sem_destroy(&loudness->ready);
+	}
+	if (loudness->blocks) {
+		jack_ringbuffer_free(loudness->blocks);
+	}
+	free(loudness->weight);
+	free(loudness->filter);
+	free(loudness->momentary_histogram);
+	free(loudness->short_term_histogram);
+	memset(loudness, 0, sizeof(struct loudness_t));
+}
+
+void loudness_set_weights(struct loudness_t *loudness, const float *weights,
+		unsigned int count) {
+	unsigned int channel;
+	for (channel = 0; channel < loudness->channels; channel++) {
+		if (channel < count) {
+			loudness->weight[channel] = weights[channel];
+		} else if (weights == NULL) {
+			loudness->weight[channel] = 1.0f;
+		}
+	}
+}
+
+static void* loudness_worker(void *arg) {
+	struct loudness_t *loudness = (struct loudness_t*) arg;
+	while (atomic_load(&loudness->running)) {
+		if (sem_wait(&loudness->ready) && errno == EINTR) {
+			continue;
+		}
+		loudness_drain(loudness);
+	}
+	return NULL;
+}
+
+int loudness_start(struct loudness_t *loudness) {
+	if (sem_init(&loudness->ready, 0, 0)) {
+		return -1;
+	}
+	atomic_store(&loudness->running, 1);
+	if (pthread_create(&loudness->worker, NULL, loudness_worker, loudness)) {
+		sem_destroy(&loudness->ready);
+		return -1;
+	}
+	loudness->threaded = 1;
+	return 0;
+}
+
+/* K-weight some samples of a channel, returns the sum of their squares */
+static double k_weight_energy(struct k_filter_t *filter,
+		const double coeff[2][5], const float *in, jack_nframes_t nframes) {
+	double z00 = filter->z[0][0], z01 = filter->z[0][1];
+	double z10 = filter->z[1][0], z11 = filter->z[1][1];
+	double sum = 0.0;
+	jack_nframes_t i;
+	for (i = 0; i < nframes; i++) {
+		// two transposed direct form II biquads
+		double x = in[i];
+		double y = coeff[0][0] * x + z00;
+		z00 = coeff[0][1] * x - coeff[0][3] * y + z01;
+		z01 = coeff[0][2] * x - coeff[0][4] * y;
+		x = y;
+		y = coeff[1][0] * x + z10;
+		z10 = coeff[1][1] * x - coeff[1][3] * y + z11;
+		z11 = coeff[1][2] * x - coeff[1][4] * y;
+		sum += y * y;
+	}
+	filter->z[0][0] = fabs(z00) < FILTER_FLOOR ? 0.0 : z00;
+	filter->z[0][1] = fabs(z01) < FILTER_FLOOR ? 0.0 : z01;
+	filter->z[1][0] = fabs(z10) < FILTER_FLOOR ? 0.0 : z10;
+	filter->z[1][1] = fabs(z11) < FILTER_FLOOR ? 0.0 : z11;
+	return sum;
+}
+
+static void queue_block(struct loudness_t *loudness, double energy) {
+	if (jack_ringbuffer_write_space(loudness->blocks) < sizeof(double)) {
+		atomic_fetch_add_explicit(&loudness->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	jack_ringbuffer_write(loudness->blocks, (const char*) &energy,
+			sizeof(double));
+	if (loudness->threaded) {
+		// sem_post never blocks, so the JACK thread may call it
+		sem_post(&loudness->ready);
+	}
+}
+
+void loudness_period(struct loudness_t *loudness, float *const *buffers,
+		jack_nframes_t nframes) {
+	jack_nframes_t done = 0;
+	unsigned int channel;
+	if (loudness->channels == 0) {
+		return;
+	}
+	while (done < nframes) {
+		// stop at the end of the block
+		jack_nframes_t n = nframes - done;
+		if (n > loudness->block_frames - loudness->block_pos) {
+			n = loudness->block_frames - loudness->block_pos;
+		}
+		for (channel = 0; channel < loudness->channels; channel++) {
+			if (buffers[channel] != NULL && loudness->weight[channel] != 0.0f) {
+				loudness->block_energy += loudness->weight[channel]
+						* k_weight_energy(&loudness->filter[channel],
+								(const double (*)[5]) loudness->coeff,
+								buffers[channel] + done, n);
+			}
+		}
+		done += n;
+		loudness->block_pos += n;
+		if (loudness->block_pos == loudness->block_frames) {
+			queue_block(loudness,
+					loudness->block_energy / loudness->block_frames);
+			loudness->block_energy = 0.0;
+			loudness->block_pos = 0;
+		}
+	}
+}
+
+/* The histogram bin of a loudness, clamped to the histogram */
+static int histogram_bin(float lufs) {
+	int bin = (int) floorf((lufs - LOUDNESS_HISTOGRAM_MIN) * 10.0f);
+	if (bin < 0) {
+		return 0;
+	}
+	return bin < LOUDNESS_HISTOGRAM_BINS ? bin : LOUDNESS_HISTOGRAM_BINS - 1;
+}
+
+/* Count a loudness that passes the absolute gate */
+static void histogram_add(unsigned long *histogram, float lufs) {
+	if (lufs >= LOUDNESS_HISTOGRAM_MIN) {
+		histogram[histogram_bin(lufs)]++;
+	}
+}
+
+/* The mean energy of the bins from first, returns the number of blocks in it */
+static unsigned long histogram_mean(const struct loudness_t *loudness,
+		const unsigned long *histogram, int first, double *mean) {
+	unsigned long count = 0;
+	double sum = 0.0;
+	int bin;
+	for (bin = first; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+		count += histogram[bin];
+		sum += histogram[bin] * loudness->bin_energy[bin];
+	}
+	*mean = count ? sum / count : 0.0;
+	return count;
+}
+
+/* Integrated loudness, the mean of the momentary blocks that pass both gates */
+static float integrated_loudness(const struct loudness_t *loudness) {
+	double mean;
+	if (!histogram_mean(loudness, loudness->momentary_histogram, 0, &mean)) {
+		return -INFINITY;
+	}
+	int gate = histogram_bin(energy_to_lufs(mean) + INTEGRATED_GATE_LU);
+	histogram_mean(loudness, loudness->momentary_histogram, gate, &mean);
+	return energy_to_lufs(mean);
+}
+
+/*
+ * Loudness range, EBU Tech 3342: the spread between the 10th and 95th
+ * percentiles of the short term loudness that passes both gates.
+ */
+static float loudness_range_of(const struct loudness_t *loudness) {
+	const unsigned long *histogram = loudness->short_term_histogram;
+	double mean;
+	if (!histogram_mean(loudness, histogram, 0, &mean)) {
+		return 0.0f;
+	}
+	int gate = histogram_bin(energy_to_lufs(mean) + RANGE_GATE_LU);
+	unsigned long count = histogram_mean(loudness, histogram, gate, &mean);
+	unsigned long seen = 0;
+	int low = -1;
+	int high = gate;
+	int bin;
+	for (bin = gate; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+		seen += histogram[bin];
+		if (low < 0 && seen > count / 10) {
+			low = bin;
+		}
+		if (seen * 100 >= count * 95) {
+			high = bin;
+			break;
+		}
+	}
+	return low < 0 ? 0.0f : (high - low) * 0.1f;
+}
+
+/* The mean energy of the last blocks, or of all of them early on */
+static double window_energy(const struct loudness_t *loudness,
+		unsigned int blocks) {
+	double sum = 0.0;
+	unsigned int i;
+	if (blocks > loudness->blocks_seen) {
+		blocks = loudness->blocks_seen;
+	}
+	for (i = 1; i <= blocks; i++) {
+		sum += loudness->recent[(loudness->recent_pos + SHORT_TERM_BLOCKS - i)
+				% SHORT_TERM_BLOCKS];
+	}
+	return blocks ? sum / blocks : 0.0;
+}
+
+static void add_block(struct loudness_t *loudness, double energy) {
+	loudness->recent[loudness->recent_pos] = energy;
+	loudness->recent_pos = (loudness->recent_pos + 1) % SHORT_TERM_BLOCKS;
+	loudness->blocks_seen++;
+
+	float momentary = energy_to_lufs(window_energy(loudness, MOMENTARY_BLOCKS));
+	float short_term = energy_to_lufs(
+			window_energy(loudness, SHORT_TERM_BLOCKS));
+	// the gated measures only take whole windows, every 100 ms
+	if (loudness->blocks_seen >= MOMENTARY_BLOCKS) {
+		histogram_add(loudness->momentary_histogram, momentary);
+	}
+	if (loudness->blocks_seen >= SHORT_TERM_BLOCKS) {
+		histogram_add(loudness->short_term_histogram, short_term);
+	}
+	publish(&loudness->momentary, momentary);
+	publish(&loudness->short_term, short_term);
+	publish(&loudness->integrated, integrated_loudness(loudness));
+	publish(&loudness->range, loudness_range_of(loudness));
+}
+
+static void clear_measures(struct loudness_t *loudness) {
+	memset(loudness->recent, 0, sizeof(loudness->recent));
+	loudness->recent_pos = 0;
+	loudness->blocks_seen = 0;
+	memset(loudness->momentary_histogram, 0,
+			LOUDNESS_HISTOGRAM_BINS * sizeof(unsigned long));
+	memset(loudness->short_term_histogram, 0,
+			LOUDNESS_HISTOGRAM_BINS * sizeof(unsigned long));
+	publish(&loudness->momentary, -INFINITY);
+	publish(&loudness->short_term, -INFINITY);
+	publish(&loudness->integrated, -INFINITY);
+	publish(&loudness->range, 0.0f);
+}
+
+void loudness_drain(struct loudness_t *loudness) {
+	double energy;
+	if (loudness->channels == 0) {
+		return;
+	}
+	if (atomic_exchange(&loudness->reset, 0)) {
+		clear_measures(loudness);
+	}
+	while (jack_ringbuffer_read_space(loudness->blocks) >= sizeof(double)) {
+		jack_ringbuffer_read(loudness->blocks, (char*) &energy, sizeof(double));
+		add_block(loudness, energy);
+	}
+}
+
+void loudness_reset(struct loudness_t *loudness) {
+	atomic_store(&loudness->reset, 1);
+	if (loudness->threaded) {
+		sem_post(&loudness->ready);
+	}
+}
+
+float loudness_momentary(struct loudness_t *loudness) {
+	return published(&loudness->momentary);
+}
+
+float loudness_short_term(struct loudness_t *loudness) {
+	return published(&loudness->short_term);
+}
+
+float loudness_integrated(struct loudness_t *loudness) {
+	return published(&loudness->integrated);
+}
+
+float loudness_range(struct loudness_t *loudness) {
+	return published(&loudness->range);
+}
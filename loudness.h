@@ -0,0 +1,134 @@
+/*
+ loudness.h
+ EBU R128 / ITU-R BS.1770 loudness meter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+/* The energies are gathered in blocks of 100 ms */
+#define LOUDNESS_BLOCKS_PER_SECOND 10
+/* momentary loudness is over 400 ms, short term over 3 s */
+#define MOMENTARY_BLOCKS 4
+#define SHORT_TERM_BLOCKS 30
+/* the block energies the JACK thread can get ahead of the worker */
+#define LOUDNESS_QUEUE_BLOCKS 256
+
+/* The gating histograms run from -70 LUFS, the absolute gate, in 0.1 LU bins */
+#define LOUDNESS_HISTOGRAM_MIN -70.0f
+#define LOUDNESS_HISTOGRAM_BINS 800
+
+/* One channel's K-weighting filter, a high shelf then a high pass */
+struct k_filter_t {
+	double z[2][2];
+};
+
+/*
+ * The JACK thread K-weights every input, sums the weighted energy of all the
+ * inputs over each 100 ms block and queues the block energy.  The worker
+ * thread, or the file analysis directly, takes the blocks from the queue and
+ * does the sliding windows, the gating and the loudness range, and publishes
+ * the results as float bits for the display.
+ */
+struct loudness_t {
+	unsigned int channels;
+	float sample_rate;
+	unsigned int block_frames;
+
+	/* K-weighting coefficients, b0 b1 b2 a1 a2 for each stage */
+	double coeff[2][5];
+	/* the weight of each channel in the sum, 1 by default */
+	float *weight;
+
+	/* JACK thread state */
+	struct k_filter_t *filter;
+	unsigned int block_pos;
+	double block_energy;
+	jack_ringbuffer_t *blocks;
+	atomic_uint dropped;
+
+	/* worker thread */
+	int threaded;
+	pthread_t worker;
+	sem_t ready;
+	atomic_int running;
+	atomic_int reset;
+
+	/* worker state */
+	double recent[SHORT_TERM_BLOCKS];
+	unsigned int recent_pos;
+	unsigned long blocks_seen;
+	unsigned long *momentary_histogram;
+	unsigned long *short_term_histogram;
+	double bin_energy[LOUDNESS_HISTOGRAM_BINS];
+
+	/* published results in LUFS and LU, as float bits */
+	_Atomic uint32_t momentary;
+	_Atomic uint32_t short_term;
+	_Atomic uint32_t integrated;
+	_Atomic uint32_t range;
+};
+
+/**
+ * set up the filters and queue for a number of channels.
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int loudness_init(struct loudness_t *loudness, unsigned int channels,
+		float sample_rate);
+
+void loudness_free(struct loudness_t *loudness);
+
+/**
+ * set the weights of the channels in the sum, BS.1770 uses 1.41 for the
+ * surround channels and 0 for the LFE.  Channels past the end of the list
+ * keep their weight.
+ * @param count the number of weights
+ */
+void loudness_set_weights(struct loudness_t *loudness, const float *weights,
+		unsigned int count);
+
+/**
+ * start the worker thread that takes the blocks from the JACK thread.
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int loudness_start(struct loudness_t *loudness);
+
+/* Called by the JACK thread with the samples of every channel */
+void loudness_period(struct loudness_t *loudness, float *const *buffers,
+		jack_nframes_t nframes);
+
+/* Take the queued blocks and update the results, done by the worker */
+void loudness_drain(struct loudness_t *loudness);
+
+/* Ask for the integrated loudness and loudness range to start again */
+void loudness_reset(struct loudness_t *loudness);
+
+float loudness_momentary(struct loudness_t *loudness);
+float loudness_short_term(struct loudness_t *loudness);
+float loudness_integrated(struct loudness_t *loudness);
+float loudness_range(struct loudness_t *loudness);
+
+#endif /* LOUDNESS_H */
@@ -0,0 +1,91 @@
+/*
+ meter_frame.h
+ The binary frames streamed to control socket subscribers
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef METER_FRAME_H
+#define METER_FRAME_H
+
+#include <stdint.h>
+
+/*
+ * After "subscribe rate" a control socket client is sent a frame for every
+ * display frame its rate allows: a header followed by a record for each
+ * channel.  Every field is in the byte order of the host and naturally
+ * aligned, so a local client can read the frame straight into these
+ * structures.  Header size gives the whole frame so a client can skip
+ * fields added to the end of either structure in later versions.
+ */
+#define METER_FRAME_MAGIC "JMF1"
+
+/* set in flags while the recording status line is shown */
+#define METER_FRAME_RECORDING 0x1
+
+struct meter_frame_header_t {
+	char magic[4];
+	/* the size of the frame, header included */
+	uint32_t size;
+	/*
+	 * the display frame this was taken at, a subscriber sees steps of about
+	 * update_rate / rate, and more when frames were dropped because it was
+	 * behind
+	 */
+	uint32_t sequence;
+	uint16_t channels;
+	uint16_t update_rate;
+	uint32_t xruns;
+	/* seconds since the recording status line was started */
+	uint32_t elapsed;
+	uint32_t flags;
+};
+
+struct meter_frame_channel_t {
+	/* the peak since the last display frame, 1 is full scale */
+	float peak;
+	/* the level in the channel's meter mode in dB against the reference */
+	float db;
+	/*
+	 * the peak hold of the level as the bar shows it, held for --hold
+	 * seconds and then falling at the --falloff rate, 1 is full scale
+	 */
+	float hold;
+	uint32_t overs;
+	uint32_t clipped;
+	/* the meter_mode_t of the channel */
+	uint8_t mode;
+	uint8_t reserved[3];
+	/* the highest sample peak since the clip counters were reset */
+	float max_peak;
+};
+
+/*
+ * A reply to a request from a subscriber comes as a frame of its own, this
+ * header then the reply line, newline and all, so it can be told from the
+ * meter frames.  The reply to "subscribe 0" is the last one framed, later
+ * replies are plain lines again.
+ */
+#define METER_REPLY_MAGIC "JMR1"
+
+struct meter_reply_header_t {
+	char magic[4];
+	/* the size of the frame, header included */
+	uint32_t size;
+};
+
+#endif /* METER_FRAME_H */
@@ -0,0 +1,109 @@
+/*
+ meter_scale.c
+ Meter deflection for a peak level
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "meter_scale.h"
+
+/*
+ db: the signal stength in db
+ width: the size of the meter
+ */
+int iec_scale(float db, int size) {
+	float def = 0.0f; /* Meter deflection %age */
+
+	if (db < -70.0f) {
+		def = 0.0f;
+	} else if (db < -60.0f) {
+		def = (db + 70.0f) * 0.25f;
+	} else if (db < -50.0f) {
+		def = (db + 60.0f) * 0.5f + 2.5f;
+	} else if (db < -40.0f) {
+		def = (db + 50.0f) * 0.75f + 7.5;
+	} else if (db < -30.0f) {
+		def = (db + 40.0f) * 1.5f + 15.0f;
+	} else if (db < -20.0f) {
+		def = (db + 30.0f) * 2.0f + 30.0f;
+	} else if (db < 0.0f) {
+		def = (db + 20.0f) * 2.5f + 50.0f;
+	} else {
+		def = 100.0f;
+	}
+
+	return (int) ((def / 100.0f) * ((float) size));
+}
+
+/* The inverse of the piecewise scale in iec_scale() */
+static float iec_db(float def) {
+	if (def < 2.5f) {
+		return def / 0.25f - 70.0f;
+	} else if (def < 7.5f) {
+		return (def - 2.5f) / 0.5f - 60.0f;
+	} else if (def < 15.0f) {
+		return (def - 7.5f) / 0.75f - 50.0f;
+	} else if (def < 30.0f) {
+		return (def - 15.0f) / 1.5f - 40.0f;
+	} else if (def < 50.0f) {
+		return (def - 30.0f) / 2.0f - 30.0f;
+	} else if (def < 100.0f) {
+		return (def - 50.0f) / 2.5f - 20.0f;
+	}
+	return 0.0f;
+}
+
+static int peak_deflection(float peak, float bias, int size) {
+	return iec_scale(20.0f * log10f(peak * bias), size);
+}
+
+int meter_scale_init(struct meter_scale_t *scale, int size, float bias) {
+	int k;
+	scale->size = size;
+	scale->threshold = (float*) malloc(size * sizeof(float));
+	if (scale->threshold == NULL) {
+		return -1;
+	}
+	for (k = 1; k <= size; k++) {
+		float peak = powf(10.0f, iec_db(100.0f * k / size) / 20.0f) / bias;
+		int step;
+		/*
+		 * Rounding puts the inverse within a few ulps of the edge of the cell,
+		 * move it onto the edge iec_scale() itself uses.
+		 */
+		for (step = 0; step < 256 && peak_deflection(peak, bias, size) < k;
+				step++) {
+			peak = nextafterf(peak, INFINITY);
+		}
+		for (step = 0;
+				step < 256 && peak > 0.0f
+						&& peak_deflection(nextafterf(peak, 0.0f), bias, size) >= k;
+				step++) {
+			peak = nextafterf(peak, 0.0f);
+		}
+		scale->threshold[k - 1] = peak;
+	}
+	return 0;
+}
+
+void meter_scale_free(struct meter_scale_t *scale) {
+	free(scale->threshold);
+	scale->threshold = NULL;
+}
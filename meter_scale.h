@@ -0,0 +1,72 @@
+/*
+ meter_scale.h
+ Meter deflection for a peak level
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef METER_SCALE_H
+#define METER_SCALE_H
+
+/*
+ * The deflection of a meter of a given size for every linear peak level.
+ * threshold[k - 1] is the smallest peak that deflects the meter by k
+ * cells, so the deflection of a peak is the number of thresholds at or below
+ * it, found without a log10f.
+ */
+struct meter_scale_t {
+	int size;
+	float *threshold;
+};
+
+/**
+ * build the table for a meter.
+ * @param size the number of steps in the meter
+ * @param bias the gain applied to a peak before it is scaled
+ * @return 0 on success, -1 if the table could not be allocated
+ */
+int meter_scale_init(struct meter_scale_t *scale, int size, float bias);
+
+void meter_scale_free(struct meter_scale_t *scale);
+
+/* The deflection from 0 to size for a peak */
+static inline int meter_scale_deflection(const struct meter_scale_t *scale,
+		float peak) {
+	const float *threshold = scale->threshold;
+	int deflection = 0;
+	int n = scale->size;
+	// branch free binary search for the number of thresholds <= peak
+	while (n > 1) {
+		int half = n / 2;
+		deflection = threshold[deflection + half - 1] <= peak ?
+				deflection + half : deflection;
+		n -= half;
+	}
+	if (n == 1 && threshold[deflection] <= peak) {
+		deflection++;
+	}
+	return deflection;
+}
+
+/**
+ * the IEC 268-18 meter deflection.
+ * @param db the signal strength in db
+ * @param size the size of the meter
+ */
+int iec_scale(float db, int size);
+
+#endif /* METER_SCALE_H */
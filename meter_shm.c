@@ -0,0 +1,124 @@
+/*
+ meter_shm.c
+ Publishes the meter levels in shared memory
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "meter_shm.h"
+
+void meter_shm_init(struct meter_shm_t *shm) {
+	memset(shm, 0, sizeof(struct meter_shm_t));
+}
+
+int meter_shm_open(struct meter_shm_t *shm, const char *name,
+		unsigned int channels, unsigned int sample_rate) {
+	meter_shm_init(shm);
+	shm->size = sizeof(struct jackmeter_shm_t)
+			+ channels * sizeof(struct jackmeter_shm_channel_t);
+	shm->peak = (float*) calloc(channels, sizeof(float));
+	shm->hold = (_Atomic uint32_t*) calloc(channels, sizeof(_Atomic uint32_t));
+	shm->name = strdup(name);
+	if (!shm->peak || !shm->hold || !shm->name) {
+		meter_shm_close(shm);
+		return -1;
+	}
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		meter_shm_close(shm);
+		return -1;
+	}
+	void *segment = MAP_FAILED;
+	if (ftruncate(fd, shm->size) == 0) {
+		segment = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				fd, 0);
+	}
+	close(fd);
+	if (segment == MAP_FAILED) {
+		shm_unlink(name);
+		meter_shm_close(shm);
+		return -1;
+	}
+	// keep the JACK thread clear of page faults, if we are allowed to
+	mlock(segment, shm->size);
+	shm->segment = (struct jackmeter_shm_t*) segment;
+	memset(shm->segment, 0, shm->size);
+	shm->segment->version = JACKMETER_SHM_VERSION;
+	shm->segment->size = shm->size;
+	shm->segment->channels = channels;
+	shm->segment->sample_rate = sample_rate;
+	atomic_thread_fence(memory_order_release);
+	shm->segment->magic = JACKMETER_SHM_MAGIC;
+	return 0;
+}
+
+void meter_shm_close(struct meter_shm_t *shm) {
+	if (shm->segment) {
+		munmap(shm->segment, shm->size);
+		shm_unlink(shm->name);
+	}
+	free(shm->name);
+	free(shm->peak);
+	free(shm->hold);
+	meter_shm_init(shm);
+}
+
+void meter_shm_publish(struct meter_shm_t *shm, jack_nframes_t nframes,
+		_Atomic uint32_t *rms, _Atomic uint32_t *overs,
+		_Atomic uint32_t *clipped) {
+	struct jackmeter_shm_t *segment = shm->segment;
+	unsigned int channel;
+	if (segment == NULL) {
+		return;
+	}
+	uint32_t sequence = atomic_load_explicit(&segment->sequence,
+			memory_order_relaxed);
+	atomic_store_explicit(&segment->sequence, sequence + 1,
+			memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (channel = 0; channel < segment->channels; channel++) {
+		struct jackmeter_shm_channel_t *out = &segment->channel[channel];
+		float peak = shm->peak[channel];
+		out->peak = peak;
+		out->rms = bits_to_peak(
+				atomic_load_explicit(&rms[channel], memory_order_relaxed));
+		out->hold = bits_to_peak(
+				atomic_load_explicit(&shm->hold[channel], memory_order_relaxed));
+		out->overs = atomic_load_explicit(&overs[channel],
+				memory_order_relaxed);
+		out->clipped = atomic_load_explicit(&clipped[channel],
+				memory_order_relaxed);
+	}
+	segment->periods++;
+	segment->frames += nframes;
+	atomic_store_explicit(&segment->sequence, sequence + 2,
+			memory_order_release);
+}
+
+void meter_shm_xrun(struct meter_shm_t *shm) {
+	if (shm->segment) {
+		atomic_fetch_add_explicit(&shm->segment->xruns, 1,
+				memory_order_relaxed);
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ meter_shm.h
+ Publishes the meter levels in shared memory
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef METER_SHM_H
+#define METER_SHM_H
+
+#include <jack/jack.h>
+
+#include "jackmeter_shm.h"
+#include "channel_store.h"
+
+/*
+ * The writer side of jackmeter_shm.h.  The JACK thread notes the peak of
+ * each channel as it meters it, then publishes every channel at once at the
+ * end of the period, so the seqlock is held odd for a copy rather than for
+ * the metering.  The display hands over its peak holds each frame for the
+ * JACK thread to copy in.  With no segment open every call returns at once.
+ */
+struct meter_shm_t {
+	struct jackmeter_shm_t *segment;
+	char *name;
+	size_t size;
+	/* JACK thread state */
+	float *peak;
+	/* the display's peak holds, as float bits */
+	_Atomic uint32_t *hold;
+};
+
+/* A writer with no segment, for meter_shm_close() */
+void meter_shm_init(struct meter_shm_t *shm);
+
+/**
+ * create and map the shared memory object name, replacing any left there.
+ * @return 0 on success, -1 on failure
+ */
+int meter_shm_open(struct meter_shm_t *shm, const char *name,
+		unsigned int channels, unsigned int sample_rate);
+
+/* Unmap and remove the segment */
+void meter_shm_close(struct meter_shm_t *shm);
+
+/* Note the peak of a channel's period, called by the JACK thread */
+static inline void meter_shm_peak(struct meter_shm_t *shm,
+		unsigned int channel, float peak) {
+	if (shm->segment) {
+		shm->peak[channel] = peak;
+	}
+}
+
+/* Hand over the peak hold of a channel, called by the display each frame */
+static inline void meter_shm_hold(struct meter_shm_t *shm,
+		unsigned int channel, float hold) {
+	if (shm->segment) {
+		atomic_store_explicit(&shm->hold[channel], peak_to_bits(hold),
+				memory_order_relaxed);
+	}
+}
+
+/**
+ * publish the period, called by the JACK thread once every channel has been
+ * metered.
+ * @param rms the published RMS level bits of each channel
+ * @param overs the overs of each channel
+ * @param clipped the full scale samples of each channel
+ */
+void meter_shm_publish(struct meter_shm_t *shm, jack_nframes_t nframes,
+		_Atomic uint32_t *rms, _Atomic uint32_t *overs,
+		_Atomic uint32_t *clipped);
+
+/* Count an xrun, called from the JACK xrun callback */
+void meter_shm_xrun(struct meter_shm_t *shm);
+
+#endif /* METER_SHM_H */
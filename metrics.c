@@ -0,0 +1,184 @@
+/*
+ metrics.c
+ Counters and timings for the metrics endpoint
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include "metrics.h"
+
+const double metrics_quantiles[METRICS_QUANTILES] = { 0.5, 0.9, 0.99 };
+
+static uint64_t bucket_bound(int i) {
+	return METRICS_FIRST_BUCKET_NS << i;
+}
+
+void metrics_time(struct metrics_timing_t *timing, uint64_t ns) {
+	int i = 0;
+	while (i < METRICS_TIME_BUCKETS && ns > bucket_bound(i)) {
+		i++;
+	}
+	metrics_count(&timing->bucket[i], 1);
+	metrics_count(&timing->sum_ns, ns);
+	if (ns > atomic_load_explicit(&timing->max_ns, memory_order_relaxed)) {
+		atomic_store_explicit(&timing->max_ns, ns, memory_order_relaxed);
+	}
+	metrics_count(&timing->count, 1);
+}
+
+void metrics_size(struct metrics_sizes_t *sizes, uint64_t bytes) {
+	int i = 0;
+	while (i < METRICS_SIZE_BUCKETS && bytes > (1ull << i)) {
+		i++;
+	}
+	metrics_count(&sizes->bucket[i], 1);
+	metrics_count(&sizes->sum, bytes);
+	metrics_count(&sizes->count, 1);
+}
+
+/*
+ * Load each bucket of a timing once, so the cumulative buckets, +Inf and
+ * count of a scrape agree however the writer races it.  Returns the number of
+ * samples in the buckets.
+ */
+static uint64_t load_buckets(struct metrics_timing_t *timing,
+		uint64_t counts[METRICS_TIME_BUCKETS + 1]) {
+	uint64_t total = 0;
+	int i;
+	for (i = 0; i <= METRICS_TIME_BUCKETS; i++) {
+		counts[i] = atomic_load_explicit(&timing->bucket[i],
+				memory_order_relaxed);
+		total += counts[i];
+	}
+	return total;
+}
+
+static double bucket_quantile(struct metrics_timing_t *timing,
+		const uint64_t counts[METRICS_TIME_BUCKETS + 1], uint64_t total,
+		double q) {
+	int i;
+	if (total == 0) {
+		return 0.0;
+	}
+	double rank = q * total;
+	double below = 0.0;
+	for (i = 0; i < METRICS_TIME_BUCKETS; i++) {
+		if (counts[i] && below + counts[i] >= rank) {
+			// spread the bucket's times evenly between its bounds
+			double low = i == 0 ? 0.0 : (double) bucket_bound(i - 1);
+			double high = (double) bucket_bound(i);
+			return low + (high - low) * (rank - below) / counts[i];
+		}
+		below += counts[i];
+	}
+	return (double) atomic_load_explicit(&timing->max_ns, memory_order_relaxed);
+}
+
+double metrics_quantile(struct metrics_timing_t *timing, double q) {
+	uint64_t counts[METRICS_TIME_BUCKETS + 1];
+	uint64_t total = load_buckets(timing, counts);
+	return bucket_quantile(timing, counts, total, q);
+}
+
+void metrics_write_timing(FILE *out, const char *name, const char *help,
+		struct metrics_timing_t *timing) {
+	metrics_write_timing_quantiles(out, name, help, timing, NULL);
+}
+
+void metrics_write_timing_quantiles(FILE *out, const char *name,
+		const char *help, struct metrics_timing_t *timing,
+		const double quantile_ns[METRICS_QUANTILES]) {
+	uint64_t counts[METRICS_TIME_BUCKETS + 1];
+	uint64_t count = load_buckets(timing, counts);
+	uint64_t cumulative = 0;
+	int i;
+	fprintf(out, "# TYPE %s_seconds histogram\n", name);
+	fprintf(out, "# UNIT %s_seconds seconds\n", name);
+	fprintf(out, "# HELP %s_seconds %s.\n", name, help);
+	for (i = 0; i < METRICS_TIME_BUCKETS; i++) {
+		cumulative += counts[i];
+		fprintf(out, "%s_seconds_bucket{le=\"%g\"} %llu\n", name,
+				bucket_bound(i) * 1e-9, (unsigned long long) cumulative);
+	}
+	fprintf(out, "%s_seconds_bucket{le=\"+Inf\"} %llu\n", name,
+			(unsigned long long) count);
+	fprintf(out, "%s_seconds_count %llu\n", name, (unsigned long long) count);
+	fprintf(out, "%s_seconds_sum %g\n", name, 1e-9
+			* atomic_load_explicit(&timing->sum_ns, memory_order_relaxed));
+
+	fprintf(out, "# TYPE %s_max_seconds gauge\n", name);
+	fprintf(out, "# UNIT %s_max_seconds seconds\n", name);
+	fprintf(out, "# HELP %s_max_seconds The longest %s.\n", name, help);
+	fprintf(out, "%s_max_seconds %g\n", name, 1e-9
+			* atomic_load_explicit(&timing->max_ns, memory_order_relaxed));
+
+	// quantile is a summary label, so the estimates go out as a summary
+	fprintf(out, "# TYPE %s_quantile_seconds summary\n", name);
+	fprintf(out, "# UNIT %s_quantile_seconds seconds\n", name);
+	fprintf(out, "# HELP %s_quantile_seconds Percentiles of the %s.\n", name,
+			help);
+	for (i = 0; i < METRICS_QUANTILES; i++) {
+		double ns = quantile_ns ? quantile_ns[i] :
+				bucket_quantile(timing, counts, count, metrics_quantiles[i]);
+		fprintf(out, "%s_quantile_seconds{quantile=\"%g\"} %g\n", name,
+				metrics_quantiles[i], 1e-9 * ns);
+	}
+	fprintf(out, "%s_quantile_seconds_count %llu\n", name,
+			(unsigned long long) count);
+	fprintf(out, "%s_quantile_seconds_sum %g\n", name, 1e-9
+			* atomic_load_explicit(&timing->sum_ns, memory_order_relaxed));
+}
+
+void metrics_write_sizes(FILE *out, const char *name, const char *help,
+		struct metrics_sizes_t *sizes) {
+	uint64_t counts[METRICS_SIZE_BUCKETS + 1];
+	uint64_t count = 0;
+	uint64_t cumulative = 0;
+	int i;
+	// one load of each bucket, +Inf and the count are their sum
+	for (i = 0; i <= METRICS_SIZE_BUCKETS; i++) {
+		counts[i] = atomic_load_explicit(&sizes->bucket[i], memory_order_relaxed);
+		count += counts[i];
+	}
+	fprintf(out, "# TYPE %s_bytes histogram\n", name);
+	fprintf(out, "# UNIT %s_bytes bytes\n", name);
+	fprintf(out, "# HELP %s_bytes %s.\n", name, help);
+	for (i = 0; i < METRICS_SIZE_BUCKETS; i++) {
+		cumulative += counts[i];
+		fprintf(out, "%s_bytes_bucket{le=\"%llu\"} %llu\n", name,
+				1ull << i, (unsigned long long) cumulative);
+	}
+	fprintf(out, "%s_bytes_bucket{le=\"+Inf\"} %llu\n", name,
+			(unsigned long long) count);
+	fprintf(out, "%s_bytes_count %llu\n", name, (unsigned long long) count);
+	fprintf(out, "%s_bytes_sum %llu\n", name, (unsigned long long)
+			atomic_load_explicit(&sizes->sum, memory_order_relaxed));
+}
+
+void metrics_write_gauge(FILE *out, const char *name, const char *help,
+		double value) {
+	fprintf(out, "# TYPE %s gauge\n", name);
+	fprintf(out, "# HELP %s %s.\n", name, help);
+	fprintf(out, "%s %g\n", name, value);
+}
+
+void metrics_write_counter(FILE *out, const char *name, const char *help,
+		uint64_t value) {
+	fprintf(out, "# TYPE %s counter\n", name);
+	fprintf(out, "# HELP %s %s.\n", name, help);
+	fprintf(out, "%s_total %llu\n", name, (unsigned long long) value);
+}
@@ -0,0 +1,127 @@
+/*
+ metrics.h
+ Counters and timings for the metrics endpoint
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* bucket i holds the times up to METRICS_FIRST_BUCKET_NS << i */
+#define METRICS_TIME_BUCKETS 16
+#define METRICS_FIRST_BUCKET_NS 1000ull
+/* bucket i holds the sizes up to 1 << i bytes */
+#define METRICS_SIZE_BUCKETS 12
+
+/*
+ * A timing has one writer, the thread that does what is timed, so it is
+ * updated with relaxed atomics that never wait, and read whenever the
+ * metrics are scraped.  A scrape counts the samples from the buckets it
+ * loaded, so the histogram it writes is always whole, though its sum can be a
+ * sample apart from them, which the exposition format allows.
+ */
+struct metrics_timing_t {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum_ns;
+	_Atomic uint64_t max_ns;
+	/* the last bucket counts the times past the last bound */
+	_Atomic uint64_t bucket[METRICS_TIME_BUCKETS + 1];
+};
+
+/* The sizes of writes, kept as a timing is */
+struct metrics_sizes_t {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t bucket[METRICS_SIZE_BUCKETS + 1];
+};
+
+struct metrics_t {
+	/* the process callback, on the JACK thread */
+	struct metrics_timing_t process;
+	/* by the xrun callback, never reset unlike the xruns on the display */
+	_Atomic uint64_t xruns;
+	/* the writes to the display, on the LCD writer thread */
+	struct metrics_timing_t lcd_write;
+	struct metrics_sizes_t lcd_write_size;
+	_Atomic uint64_t lcd_bytes;
+	_Atomic uint64_t lcd_short_writes;
+	/* frame timer expirations the main loop was too late for */
+	_Atomic uint64_t frames_missed;
+};
+
+static inline uint64_t metrics_now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void metrics_count(_Atomic uint64_t *counter, uint64_t n) {
+	atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+/* Record a time, called only by the timing's writer */
+void metrics_time(struct metrics_timing_t *timing, uint64_t ns);
+
+/* Record a size, called only by the writer of the sizes */
+void metrics_size(struct metrics_sizes_t *sizes, uint64_t bytes);
+
+/**
+ * estimate a quantile of a timing from its buckets.
+ * @param q from 0 to 1
+ * @return the time in nanoseconds, 0 if nothing was timed
+ */
+double metrics_quantile(struct metrics_timing_t *timing, double q);
+
+/* The percentiles written with a timing, the 50th, 90th and 99th */
+#define METRICS_QUANTILES 3
+extern const double metrics_quantiles[METRICS_QUANTILES];
+
+/**
+ * write a timing as an OpenMetrics histogram in seconds, with a gauge of
+ * its largest time and a summary of its metrics_quantiles.
+ */
+void metrics_write_timing(FILE *out, const char *name, const char *help,
+		struct metrics_timing_t *timing);
+
+/**
+ * write a timing as metrics_write_timing() does, with percentiles measured
+ * elsewhere rather than estimated from its buckets.
+ * @param quantile_ns the time of each of metrics_quantiles in nanoseconds
+ */
+void metrics_write_timing_quantiles(FILE *out, const char *name,
+		const char *help, struct metrics_timing_t *timing,
+		const double quantile_ns[METRICS_QUANTILES]);
+
+/* Write sizes as an OpenMetrics histogram in bytes */
+void metrics_write_sizes(FILE *out, const char *name, const char *help,
+		struct metrics_sizes_t *sizes);
+
+/* Write a gauge as an OpenMetrics gauge family of one sample */
+void metrics_write_gauge(FILE *out, const char *name, const char *help,
+		double value);
+
+/* Write a counter as an OpenMetrics counter family of one sample */
+void metrics_write_counter(FILE *out, const char *name, const char *help,
+		uint64_t value);
+
+#endif /* METRICS_H */
@@ -0,0 +1,299 @@
+/*
+ metrics_server.c
+ Serves the metrics to scrapers over HTTP
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+/* for accept4 and open_memstream */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics_server.h"
+
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static void client_reset(struct metrics_client_t *client) {
+	client->fd = -1;
+	client->request_len = 0;
+	client->reply = NULL;
+	client->reply_len = 0;
+	client->reply_sent = 0;
+}
+
+static void client_close(struct metrics_client_t *client) {
+	close(client->fd);
+	free(client->reply);
+	client_reset(client);
+}
+
+void metrics_server_init(struct metrics_server_t *server) {
+	int i;
+	memset(server, 0, sizeof(struct metrics_server_t));
+	server->fd = -1;
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		client_reset(&server->client[i]);
+	}
+}
+
+/* Bind a unix domain socket at path */
+static int bind_unix(struct metrics_server_t *server, const char *path) {
+	struct sockaddr_un address;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	server->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0);
+	if (server->fd < 0) {
+		return -1;
+	}
+	unlink(path);
+	if (bind(server->fd, (struct sockaddr*) &address, sizeof(address))) {
+		return -1;
+	}
+	server->path = strdup(path);
+	return 0;
+}
+
+/* Bind a TCP socket at [host:]port */
+static int bind_tcp(struct metrics_server_t *server, const char *address) {
+	struct sockaddr_in in;
+	const char *colon = strrchr(address, ':');
+	const char *port = colon ? colon + 1 : address;
+	char *end;
+	long number = strtol(port, &end, 10);
+	int one = 1;
+	if (*port == '\0' || *end != '\0' || number < 1 || number > 65535) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_port = htons((uint16_t) number);
+	in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (colon && colon != address) {
+		char host[INET_ADDRSTRLEN];
+		size_t len = colon - address;
+		if (len >= sizeof(host)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(host, address, len);
+		host[len] = '\0';
+		if (inet_pton(AF_INET, host, &in.sin_addr) != 1) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	server->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->fd < 0) {
+		return -1;
+	}
+	setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	return bind(server->fd, (struct sockaddr*) &in, sizeof(in));
+}
+
+int metrics_server_open(struct metrics_server_t *server, const char *address,
+		void (*compose)(FILE *out, void *context), void *context) {
+	metrics_server_init(server);
+	int bound = strchr(address, '/') ?
+			bind_unix(server, address) : bind_tcp(server, address);
+	if (bound || listen(server->fd, METRICS_MAX_CLIENTS)) {
+		metrics_server_close(server);
+		return -1;
+	}
+	server->compose = compose;
+	server->context = context;
+	return 0;
+}
+
+void metrics_server_close(struct metrics_server_t *server) {
+	int i;
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (server->client[i].fd >= 0) {
+			client_close(&server->client[i]);
+		}
+	}
+	if (server->fd >= 0) {
+		close(server->fd);
+		server->fd = -1;
+	}
+	if (server->path) {
+		unlink(server->path);
+		free(server->path);
+		server->path = NULL;
+	}
+}
+
+int metrics_server_pollfds(const struct metrics_server_t *server,
+		struct pollfd *fds) {
+	int count = 0;
+	int i;
+	if (server->fd < 0) {
+		return 0;
+	}
+	fds[count].fd = server->fd;
+	fds[count].events = POLLIN;
+	fds[count++].revents = 0;
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		const struct metrics_client_t *client = &server->client[i];
+		if (client->fd >= 0) {
+			fds[count].fd = client->fd;
+			fds[count].events = client->reply ? POLLOUT : POLLIN;
+			fds[count++].revents = 0;
+		}
+	}
+	return count;
+}
+
+static void accept_clients(struct metrics_server_t *server) {
+	int fd;
+	while ((fd = accept4(server->fd, NULL, NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		int i;
+		for (i = 0; i < METRICS_MAX_CLIENTS && server->client[i].fd >= 0;
+				i++) {
+		}
+		if (i == METRICS_MAX_CLIENTS) {
+			// the scraper tries again at its next interval
+			close(fd);
+			continue;
+		}
+		server->client[i].fd = fd;
+	}
+}
+
+/* Compose the response to a complete request */
+static int compose_reply(struct metrics_server_t *server,
+		struct metrics_client_t *client) {
+	char *body = NULL;
+	size_t body_len = 0;
+	FILE *out = open_memstream(&body, &body_len);
+	if (out == NULL) {
+		return -1;
+	}
+	server->compose(out, server->context);
+	fprintf(out, "# EOF\n");
+	fclose(out);
+	out = open_memstream(&client->reply, &client->reply_len);
+	if (out == NULL) {
+		free(body);
+		return -1;
+	}
+	fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: " CONTENT_TYPE
+			"\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+	fwrite(body, 1, body_len, out);
+	fclose(out);
+	free(body);
+	client->reply_sent = 0;
+	return 0;
+}
+
+/* The request ends at a blank line, or when there is no more room for it */
+static int request_complete(const struct metrics_client_t *client) {
+	return client->request_len == METRICS_REQUEST_SIZE - 1
+			|| strstr(client->request, "\r\n\r\n")
+			|| strstr(client->request, "\n\n");
+}
+
+/* Read the request, returns -1 once the client has gone */
+static int client_read(struct metrics_server_t *server,
+		struct metrics_client_t *client) {
+	for (;;) {
+		ssize_t len = recv(client->fd, &client->request[client->request_len],
+				METRICS_REQUEST_SIZE - 1 - client->request_len, MSG_DONTWAIT);
+		if (len == 0) {
+			return -1;
+		}
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		client->request_len += len;
+		client->request[client->request_len] = '\0';
+		if (request_complete(client)) {
+			return compose_reply(server, client);
+		}
+	}
+}
+
+/* Send what the socket takes, returns 1 once the reply is sent, -1 on error */
+static int client_write(struct metrics_client_t *client) {
+	while (client->reply_sent < client->reply_len) {
+		ssize_t sent = send(client->fd, &client->reply[client->reply_sent],
+				client->reply_len - client->reply_sent,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		client->reply_sent += sent;
+	}
+	return 1;
+}
+
+static struct metrics_client_t* find_client(struct metrics_server_t *server,
+		int fd) {
+	int i;
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (server->client[i].fd == fd) {
+			return &server->client[i];
+		}
+	}
+	return NULL;
+}
+
+void metrics_server_handle(struct metrics_server_t *server,
+		const struct pollfd *fds, int count) {
+	int i;
+	for (i = 1; i < count; i++) {
+		struct metrics_client_t *client = find_client(server, fds[i].fd);
+		if (client == NULL || !fds[i].revents) {
+			continue;
+		}
+		int done = 0;
+		if (client->reply == NULL) {
+			done = client_read(server, client) < 0;
+		}
+		// the reply is tried straight away, POLLOUT only finishes it
+		if (!done && client->reply) {
+			done = client_write(client) != 0;
+		}
+		if (done) {
+			client_close(client);
+		}
+	}
+	if (count > 0 && (fds[0].revents & POLLIN)) {
+		accept_clients(server);
+	}
+}
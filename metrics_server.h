@@ -0,0 +1,87 @@
+/*
+ metrics_server.h
+ Serves the metrics to scrapers over HTTP
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <poll.h>
+
+#define METRICS_MAX_CLIENTS 4
+/* the most of a request kept, the rest is ignored */
+#define METRICS_REQUEST_SIZE 1024
+/* the most poll entries metrics_server_pollfds() fills */
+#define METRICS_POLL_FDS (1 + METRICS_MAX_CLIENTS)
+
+/*
+ * A scraper connects, sends an HTTP request and gets the metrics as an
+ * HTTP/1.0 response, then the connection is closed.  Whatever the request
+ * is for, the answer is the metrics.  The response is composed in full when
+ * the request ends and sent as the socket takes it, so the main loop never
+ * waits for a scraper.
+ */
+struct metrics_client_t {
+	int fd;
+	char request[METRICS_REQUEST_SIZE];
+	int request_len;
+	char *reply;
+	size_t reply_len;
+	size_t reply_sent;
+};
+
+struct metrics_server_t {
+	int fd;
+	/* the path of a unix domain socket, NULL for TCP */
+	char *path;
+	struct metrics_client_t client[METRICS_MAX_CLIENTS];
+	/* writes the metrics in the OpenMetrics text format */
+	void (*compose)(FILE *out, void *context);
+	void *context;
+};
+
+/* A server that is not listening, for metrics_server_close() */
+void metrics_server_init(struct metrics_server_t *server);
+
+/**
+ * listen for scrapers.
+ * @param address a path for a unix domain socket, or [host:]port for TCP,
+ * where the host is the loopback address when it is left out
+ * @return 0 on success, -1 on failure
+ */
+int metrics_server_open(struct metrics_server_t *server, const char *address,
+		void (*compose)(FILE *out, void *context), void *context);
+
+void metrics_server_close(struct metrics_server_t *server);
+
+/**
+ * fill in the poll entries of the socket and its clients.
+ * @param fds room for METRICS_POLL_FDS entries
+ * @return the number of entries filled
+ */
+int metrics_server_pollfds(const struct metrics_server_t *server,
+		struct pollfd *fds);
+
+/* Accept scrapers, answer their requests and send the responses */
+void metrics_server_handle(struct metrics_server_t *server,
+		const struct pollfd *fds, int count);
+
+#endif /* METRICS_SERVER_H */
@@ -0,0 +1,414 @@
+/*
+ peak_kernel.c
+ Absolute peak of a buffer of samples
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "peak_kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PEAK_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PEAK_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+static inline float abs_sample(float s) {
+	union {
+		float f;
+		uint32_t u;
+	} v;
+	v.f = s;
+	v.u &= 0x7fffffffu;
+	return v.f;
+}
+
+/*
+ * Portable kernel.  The select keeps the running peak when a sample is NaN,
+ * and four accumulators let the compiler keep the comparisons in flight.
+ */
+static float peak_abs_max_scalar(const float *buf, size_t n) {
+	float p0 = 0.0f, p1 = 0.0f, p2 = 0.0f, p3 = 0.0f;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const float s0 = abs_sample(buf[i]);
+		const float s1 = abs_sample(buf[i + 1]);
+		const float s2 = abs_sample(buf[i + 2]);
+		const float s3 = abs_sample(buf[i + 3]);
+		p0 = s0 > p0 ? s0 : p0;
+		p1 = s1 > p1 ? s1 : p1;
+		p2 = s2 > p2 ? s2 : p2;
+		p3 = s3 > p3 ? s3 : p3;
+	}
+	for (; i < n; i++) {
+		const float s = abs_sample(buf[i]);
+		p0 = s > p0 ? s : p0;
+	}
+	p0 = p1 > p0 ? p1 : p0;
+	p2 = p3 > p2 ? p3 : p2;
+	return p2 > p0 ? p2 : p0;
+}
+
+static float sum_squares_scalar(const float *buf, size_t n) {
+	float e0 = 0.0f, e1 = 0.0f, e2 = 0.0f, e3 = 0.0f;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		e0 += buf[i] * buf[i];
+		e1 += buf[i + 1] * buf[i + 1];
+		e2 += buf[i + 2] * buf[i + 2];
+		e3 += buf[i + 3] * buf[i + 3];
+	}
+	for (; i < n; i++) {
+		e0 += buf[i] * buf[i];
+	}
+	return (e0 + e1) + (e2 + e3);
+}
+
+/* BS.1770-4 Annex 2, true_peak_coeff[phase][tap] */
+static const float true_peak_coeff[TRUE_PEAK_PHASES][TRUE_PEAK_TAPS] = {
+	{ 0.0017089843750f, 0.0109863281250f, -0.0196533203125f,
+		0.0332031250000f, -0.0594482421875f, 0.1373291015625f,
+		0.9721679687500f, -0.1022949218750f, 0.0476074218750f,
+		-0.0266113281250f, 0.0148925781250f, -0.0083007812500f },
+	{ -0.0291748046875f, 0.0292968750000f, -0.0517578125000f,
+		0.0891113281250f, -0.1665039062500f, 0.4650878906250f,
+		0.7797851562500f, -0.2003173828125f, 0.1015625000000f,
+		-0.0582275390625f, 0.0330810546875f, -0.0189208984375f },
+	{ -0.0189208984375f, 0.0330810546875f, -0.0582275390625f,
+		0.1015625000000f, -0.2003173828125f, 0.7797851562500f,
+		0.4650878906250f, -0.1665039062500f, 0.0891113281250f,
+		-0.0517578125000f, 0.0292968750000f, -0.0291748046875f },
+	{ -0.0083007812500f, 0.0148925781250f, -0.0266113281250f,
+		0.0476074218750f, -0.1022949218750f, 0.9721679687500f,
+		0.1373291015625f, -0.0594482421875f, 0.0332031250000f,
+		-0.0196533203125f, 0.0109863281250f, 0.0017089843750f }
+};
+
+/*
+ * The SIMD kernels below work on consecutive samples in each lane, so each
+ * tap is a broadcast coefficient times the samples it delays, and the four
+ * phases are four accumulators.
+ */
+static float true_peak_max_scalar(const float *buf, size_t n) {
+	float peak = 0.0f;
+	size_t i;
+	int phase, tap;
+	for (i = 0; i < n; i++) {
+		for (phase = 0; phase < TRUE_PEAK_PHASES; phase++) {
+			float y = 0.0f;
+			for (tap = 0; tap < TRUE_PEAK_TAPS; tap++) {
+				y += true_peak_coeff[phase][tap] * buf[(ptrdiff_t) i - tap];
+			}
+			y = abs_sample(y);
+			peak = y > peak ? y : peak;
+		}
+	}
+	return peak;
+}
+
+static int always_supported(void) {
+	return 1;
+}
+
+#ifdef PEAK_KERNEL_X86
+
+/*
+ * maxps returns its second operand when either is NaN, so the running peak is
+ * always passed second to ignore NaN samples.
+ */
+__attribute__((target("sse2")))
+static float peak_abs_max_sse2(const float *buf, size_t n) {
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 p0 = _mm_setzero_ps();
+	__m128 p1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		p0 = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(buf + i), mask), p0);
+		p1 = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(buf + i + 4), mask), p1);
+	}
+	p0 = _mm_max_ps(p1, p0);
+	float lanes[4];
+	_mm_storeu_ps(lanes, p0);
+	float peak = peak_abs_max_scalar(buf + i, n - i);
+	for (i = 0; i < 4; i++) {
+		peak = lanes[i] > peak ? lanes[i] : peak;
+	}
+	return peak;
+}
+
+__attribute__((target("sse2")))
+static float sum_squares_sse2(const float *buf, size_t n) {
+	__m128 e0 = _mm_setzero_ps();
+	__m128 e1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128 s0 = _mm_loadu_ps(buf + i);
+		const __m128 s1 = _mm_loadu_ps(buf + i + 4);
+		e0 = _mm_add_ps(_mm_mul_ps(s0, s0), e0);
+		e1 = _mm_add_ps(_mm_mul_ps(s1, s1), e1);
+	}
+	e0 = _mm_add_ps(e0, e1);
+	float lanes[4];
+	_mm_storeu_ps(lanes, e0);
+	return sum_squares_scalar(buf + i, n - i)
+			+ ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+}
+
+__attribute__((target("sse2")))
+static float true_peak_max_sse2(const float *buf, size_t n) {
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 peak = _mm_setzero_ps();
+	size_t i = 0;
+	int tap;
+	for (; i + 4 <= n; i += 4) {
+		__m128 y0 = _mm_setzero_ps();
+		__m128 y1 = _mm_setzero_ps();
+		__m128 y2 = _mm_setzero_ps();
+		__m128 y3 = _mm_setzero_ps();
+		for (tap = 0; tap < TRUE_PEAK_TAPS; tap++) {
+			const __m128 x = _mm_loadu_ps(buf + i - tap);
+			y0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(true_peak_coeff[0][tap]), x),
+					y0);
+			y1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(true_peak_coeff[1][tap]), x),
+					y1);
+			y2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(true_peak_coeff[2][tap]), x),
+					y2);
+			y3 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(true_peak_coeff[3][tap]), x),
+					y3);
+		}
+		y0 = _mm_max_ps(_mm_and_ps(y0, mask), _mm_and_ps(y1, mask));
+		y2 = _mm_max_ps(_mm_and_ps(y2, mask), _mm_and_ps(y3, mask));
+		peak = _mm_max_ps(_mm_max_ps(y0, y2), peak);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, peak);
+	float tail = true_peak_max_scalar(buf + i, n - i);
+	for (i = 0; i < 4; i++) {
+		tail = lanes[i] > tail ? lanes[i] : tail;
+	}
+	return tail;
+}
+
+static int sse2_supported(void) {
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("avx2")))
+static float peak_abs_max_avx2(const float *buf, size_t n) {
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 p0 = _mm256_setzero_ps();
+	__m256 p1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		p0 = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(buf + i), mask), p0);
+		p1 = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(buf + i + 8), mask),
+				p1);
+	}
+	p0 = _mm256_max_ps(p1, p0);
+	float lanes[8];
+	_mm256_storeu_ps(lanes, p0);
+	// the tail is legacy SSE code, avoid the AVX to SSE transition penalty
+	_mm256_zeroupper();
+	float peak = peak_abs_max_scalar(buf + i, n - i);
+	for (i = 0; i < 8; i++) {
+		peak = lanes[i] > peak ? lanes[i] : peak;
+	}
+	return peak;
+}
+
+__attribute__((target("avx2,fma")))
+static float sum_squares_avx2(const float *buf, size_t n) {
+	__m256 e0 = _mm256_setzero_ps();
+	__m256 e1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256 s0 = _mm256_loadu_ps(buf + i);
+		const __m256 s1 = _mm256_loadu_ps(buf + i + 8);
+		e0 = _mm256_fmadd_ps(s0, s0, e0);
+		e1 = _mm256_fmadd_ps(s1, s1, e1);
+	}
+	e0 = _mm256_add_ps(e0, e1);
+	float lanes[8];
+	_mm256_storeu_ps(lanes, e0);
+	_mm256_zeroupper();
+	return sum_squares_scalar(buf + i, n - i)
+			+ (((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+					+ ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7])));
+}
+
+__attribute__((target("avx2,fma")))
+static float true_peak_max_avx2(const float *buf, size_t n) {
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 peak = _mm256_setzero_ps();
+	size_t i = 0;
+	int tap;
+	for (; i + 8 <= n; i += 8) {
+		__m256 y0 = _mm256_setzero_ps();
+		__m256 y1 = _mm256_setzero_ps();
+		__m256 y2 = _mm256_setzero_ps();
+		__m256 y3 = _mm256_setzero_ps();
+		for (tap = 0; tap < TRUE_PEAK_TAPS; tap++) {
+			const __m256 x = _mm256_loadu_ps(buf + i - tap);
+			y0 = _mm256_fmadd_ps(_mm256_broadcast_ss(&true_peak_coeff[0][tap]),
+					x, y0);
+			y1 = _mm256_fmadd_ps(_mm256_broadcast_ss(&true_peak_coeff[1][tap]),
+					x, y1);
+			y2 = _mm256_fmadd_ps(_mm256_broadcast_ss(&true_peak_coeff[2][tap]),
+					x, y2);
+			y3 = _mm256_fmadd_ps(_mm256_broadcast_ss(&true_peak_coeff[3][tap]),
+					x, y3);
+		}
+		y0 = _mm256_max_ps(_mm256_and_ps(y0, mask), _mm256_and_ps(y1, mask));
+		y2 = _mm256_max_ps(_mm256_and_ps(y2, mask), _mm256_and_ps(y3, mask));
+		peak = _mm256_max_ps(_mm256_max_ps(y0, y2), peak);
+	}
+	float lanes[8];
+	_mm256_storeu_ps(lanes, peak);
+	_mm256_zeroupper();
+	float tail = true_peak_max_scalar(buf + i, n - i);
+	for (i = 0; i < 8; i++) {
+		tail = lanes[i] > tail ? lanes[i] : tail;
+	}
+	return tail;
+}
+
+static int avx2_supported(void) {
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+#endif /* PEAK_KERNEL_X86 */
+
+#ifdef PEAK_KERNEL_NEON
+
+/* vmaxq_f32 propagates NaN on 32 bit ARM, so compare and select instead */
+static float peak_abs_max_neon(const float *buf, size_t n) {
+	float32x4_t p0 = vdupq_n_f32(0.0f);
+	float32x4_t p1 = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const float32x4_t s0 = vabsq_f32(vld1q_f32(buf + i));
+		const float32x4_t s1 = vabsq_f32(vld1q_f32(buf + i + 4));
+		p0 = vbslq_f32(vcgtq_f32(s0, p0), s0, p0);
+		p1 = vbslq_f32(vcgtq_f32(s1, p1), s1, p1);
+	}
+	p0 = vbslq_f32(vcgtq_f32(p1, p0), p1, p0);
+	float lanes[4];
+	vst1q_f32(lanes, p0);
+	float peak = peak_abs_max_scalar(buf + i, n - i);
+	for (i = 0; i < 4; i++) {
+		peak = lanes[i] > peak ? lanes[i] : peak;
+	}
+	return peak;
+}
+
+static float sum_squares_neon(const float *buf, size_t n) {
+	float32x4_t e0 = vdupq_n_f32(0.0f);
+	float32x4_t e1 = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const float32x4_t s0 = vld1q_f32(buf + i);
+		const float32x4_t s1 = vld1q_f32(buf + i + 4);
+		e0 = vmlaq_f32(e0, s0, s0);
+		e1 = vmlaq_f32(e1, s1, s1);
+	}
+	e0 = vaddq_f32(e0, e1);
+	float lanes[4];
+	vst1q_f32(lanes, e0);
+	return sum_squares_scalar(buf + i, n - i)
+			+ ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+}
+
+static float true_peak_max_neon(const float *buf, size_t n) {
+	float32x4_t peak = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	int tap;
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t y0 = vdupq_n_f32(0.0f);
+		float32x4_t y1 = vdupq_n_f32(0.0f);
+		float32x4_t y2 = vdupq_n_f32(0.0f);
+		float32x4_t y3 = vdupq_n_f32(0.0f);
+		for (tap = 0; tap < TRUE_PEAK_TAPS; tap++) {
+			const float32x4_t x = vld1q_f32(buf + i - tap);
+			y0 = vmlaq_n_f32(y0, x, true_peak_coeff[0][tap]);
+			y1 = vmlaq_n_f32(y1, x, true_peak_coeff[1][tap]);
+			y2 = vmlaq_n_f32(y2, x, true_peak_coeff[2][tap]);
+			y3 = vmlaq_n_f32(y3, x, true_peak_coeff[3][tap]);
+		}
+		// NaN fails every compare, so it never replaces the running peak
+		y0 = vabsq_f32(y0);
+		y1 = vabsq_f32(y1);
+		y2 = vabsq_f32(y2);
+		y3 = vabsq_f32(y3);
+		peak = vbslq_f32(vcgtq_f32(y0, peak), y0, peak);
+		peak = vbslq_f32(vcgtq_f32(y1, peak), y1, peak);
+		peak = vbslq_f32(vcgtq_f32(y2, peak), y2, peak);
+		peak = vbslq_f32(vcgtq_f32(y3, peak), y3, peak);
+	}
+	float lanes[4];
+	vst1q_f32(lanes, peak);
+	float tail = true_peak_max_scalar(buf + i, n - i);
+	for (i = 0; i < 4; i++) {
+		tail = lanes[i] > tail ? lanes[i] : tail;
+	}
+	return tail;
+}
+
+#endif /* PEAK_KERNEL_NEON */
+
+const struct peak_kernel_info peak_kernels[] = {
+	{ "scalar", peak_abs_max_scalar, sum_squares_scalar, true_peak_max_scalar,
+		always_supported },
+#ifdef PEAK_KERNEL_X86
+	{ "sse2", peak_abs_max_sse2, sum_squares_sse2, true_peak_max_sse2,
+		sse2_supported },
+	{ "avx2", peak_abs_max_avx2, sum_squares_avx2, true_peak_max_avx2,
+		avx2_supported },
+#endif
+#ifdef PEAK_KERNEL_NEON
+	{ "neon", peak_abs_max_neon, sum_squares_neon, true_peak_max_neon,
+		always_supported },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+peak_kernel_t peak_abs_max = peak_abs_max_scalar;
+energy_kernel_t sum_squares = sum_squares_scalar;
+true_peak_kernel_t true_peak_max = true_peak_max_scalar;
+
+const char* peak_kernel_init(void) {
+	const struct peak_kernel_info *info;
+	const char *name = peak_kernels[0].name;
+#ifdef PEAK_KERNEL_X86
+	__builtin_cpu_init();
+#endif
+	for (info = peak_kernels; info->name; info++) {
+		if (info->supported()) {
+			peak_abs_max = info->kernel;
+			sum_squares = info->energy;
+			true_peak_max = info->true_peak;
+			name = info->name;
+		}
+	}
+	return name;
+}
@@ -0,0 +1,76 @@
+/*
+ peak_kernel.h
+ Absolute peak of a buffer of samples
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef PEAK_KERNEL_H
+#define PEAK_KERNEL_H
+
+#include <stddef.h>
+
+/*
+ * Returns the largest absolute sample value in buf, or 0 when n is 0.
+ * NaN samples are ignored.
+ */
+typedef float (*peak_kernel_t)(const float *buf, size_t n);
+
+/* Returns the sum of the squares of the samples in buf */
+typedef float (*energy_kernel_t)(const float *buf, size_t n);
+
+/*
+ * TRUE PEAK
+ *
+ * The true peak is the largest absolute value of the signal oversampled 4
+ * times by the 48 tap interpolation filter of ITU-R BS.1770-4 Annex 2, run
+ * as 4 phases of 12 taps.  A true peak kernel returns the true peak of the
+ * samples buf[0] to buf[n - 1], and reads the TRUE_PEAK_HISTORY samples
+ * before buf as the ones that came before them.
+ */
+#define TRUE_PEAK_PHASES 4
+#define TRUE_PEAK_TAPS 12
+#define TRUE_PEAK_HISTORY (TRUE_PEAK_TAPS - 1)
+typedef float (*true_peak_kernel_t)(const float *buf, size_t n);
+
+struct peak_kernel_info {
+	const char *name;
+	peak_kernel_t kernel;
+	energy_kernel_t energy;
+	true_peak_kernel_t true_peak;
+	/* non zero if the running cpu can execute the kernel */
+	int (*supported)(void);
+};
+
+/* The kernels selected by peak_kernel_init() */
+extern peak_kernel_t peak_abs_max;
+extern energy_kernel_t sum_squares;
+extern true_peak_kernel_t true_peak_max;
+
+/**
+ * select the fastest kernel the cpu supports.
+ * @return the name of the kernel selected
+ */
+const char* peak_kernel_init(void);
+
+/**
+ * the kernels compiled into this program, fastest last, terminated by an
+ * entry with a NULL name.
+ */
+extern const struct peak_kernel_info peak_kernels[];
+
+#endif /* PEAK_KERNEL_H */
@@ -0,0 +1,192 @@
+/*
+ process_timing.c
+ How long the JACK process callback takes
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "process_timing.h"
+
+#ifdef PROCESS_TIMING
+
+/* how long init spins to give the first records a tick length */
+#define CALIBRATE_NS 2000000
+
+static uint64_t clock_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* The bucket of a time, exact below PROCESS_TIMING_SUB_BUCKETS ns */
+static unsigned int bucket_index(uint64_t ns) {
+	if (ns < PROCESS_TIMING_SUB_BUCKETS) {
+		return (unsigned int) ns;
+	}
+	if (ns > UINT32_MAX) {
+		ns = UINT32_MAX;
+	}
+	unsigned int msb = 63 - __builtin_clzll(ns);
+	unsigned int shift = msb - PROCESS_TIMING_SUB_BITS;
+	unsigned int sub = (unsigned int) (ns >> shift)
+			& (PROCESS_TIMING_SUB_BUCKETS - 1);
+	return (shift + 1) * PROCESS_TIMING_SUB_BUCKETS + sub;
+}
+
+/* The middle of the times in a bucket */
+static double bucket_value(unsigned int index) {
+	if (index < PROCESS_TIMING_SUB_BUCKETS) {
+		return index;
+	}
+	unsigned int shift = index / PROCESS_TIMING_SUB_BUCKETS - 1;
+	unsigned int sub = index % PROCESS_TIMING_SUB_BUCKETS;
+	double low = (double) ((uint64_t) (PROCESS_TIMING_SUB_BUCKETS + sub)
+			<< shift);
+	return low + ((uint64_t) 1 << shift) / 2.0;
+}
+
+/*
+ * Work out the length of a tick from the cycle counter and the clock since
+ * timing started, which gets more exact the longer the meter runs.
+ */
+static void calibrate(struct process_timing_t *timing) {
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t ticks = process_timing_now() - timing->start_ticks;
+	uint64_t ns = clock_ns() - timing->start_ns;
+	if (ticks > 0 && ns > 1000000) {
+		timing->ns_per_tick = (double) ns / ticks;
+	}
+#endif
+}
+
+int process_timing_init(struct process_timing_t *timing,
+		jack_nframes_t sample_rate) {
+	memset(timing, 0, sizeof(struct process_timing_t));
+	timing->sample_rate = sample_rate;
+	timing->ring = jack_ringbuffer_create(
+			PROCESS_TIMING_RING * sizeof(struct process_timing_record_t));
+	if (timing->ring == NULL) {
+		return -1;
+	}
+	jack_ringbuffer_mlock(timing->ring);
+	timing->start_ns = clock_ns();
+	timing->start_ticks = process_timing_now();
+	timing->ns_per_tick = 1.0;
+	// a short spin times the ticks before any period is recorded
+	while (clock_ns() - timing->start_ns < CALIBRATE_NS) {
+	}
+	calibrate(timing);
+	return 0;
+}
+
+void process_timing_free(struct process_timing_t *timing) {
+	if (timing->ring) {
+		jack_ringbuffer_free(timing->ring);
+		timing->ring = NULL;
+	}
+}
+
+void process_timing_drain(struct process_timing_t *timing) {
+	struct process_timing_record_t record;
+	if (timing->ring == NULL) {
+		return;
+	}
+	calibrate(timing);
+	while (jack_ringbuffer_read_space(timing->ring) >= sizeof(record)) {
+		jack_ringbuffer_read(timing->ring, (char*) &record, sizeof(record));
+		uint64_t ns = (uint64_t) (record.ticks * timing->ns_per_tick);
+		timing->bucket[bucket_index(ns)]++;
+		if (timing->count == 0 || ns < timing->min_ns) {
+			timing->min_ns = ns;
+		}
+		if (ns > timing->max_ns) {
+			timing->max_ns = ns;
+		}
+		timing->sum_ns += ns;
+		timing->count++;
+		if (timing->metrics) {
+			metrics_time(timing->metrics, ns);
+		}
+		if (record.nframes) {
+			double load = ns * 1e-9 * timing->sample_rate / record.nframes;
+			if (load > timing->max_load) {
+				timing->max_load = load;
+			}
+		}
+	}
+}
+
+double process_timing_percentile(struct process_timing_t *timing, double q) {
+	uint64_t rank = (uint64_t) (q * timing->count);
+	uint64_t seen = 0;
+	unsigned int i;
+	for (i = 0; i < PROCESS_TIMING_BUCKETS; i++) {
+		seen += timing->bucket[i];
+		if (seen > rank) {
+			return bucket_value(i);
+		}
+	}
+	return timing->max_ns;
+}
+
+int process_timing_stats(struct process_timing_t *timing,
+		struct process_timing_stats_t *stats) {
+	memset(stats, 0, sizeof(struct process_timing_stats_t));
+	process_timing_drain(timing);
+	stats->count = timing->count;
+	stats->dropped = atomic_load(&timing->dropped);
+	if (timing->count) {
+		stats->min = timing->min_ns;
+		stats->mean = timing->sum_ns / timing->count;
+		stats->p50 = process_timing_percentile(timing, 0.5);
+		stats->p99 = process_timing_percentile(timing, 0.99);
+		stats->p999 = process_timing_percentile(timing, 0.999);
+		stats->max = timing->max_ns;
+		stats->max_load = timing->max_load;
+	}
+	return 0;
+}
+
+#else
+
+int process_timing_init(struct process_timing_t *timing,
+		jack_nframes_t sample_rate) {
+	memset(timing, 0, sizeof(struct process_timing_t));
+	return 0;
+}
+
+void process_timing_free(struct process_timing_t *timing) {
+}
+
+void process_timing_drain(struct process_timing_t *timing) {
+}
+
+double process_timing_percentile(struct process_timing_t *timing, double q) {
+	return 0.0;
+}
+
+int process_timing_stats(struct process_timing_t *timing,
+		struct process_timing_stats_t *stats) {
+	memset(stats, 0, sizeof(struct process_timing_stats_t));
+	return -1;
+}
+
+#endif /* PROCESS_TIMING */
@@ -0,0 +1,163 @@
+/*
+ process_timing.h
+ How long the JACK process callback takes
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef PROCESS_TIMING_H
+#define PROCESS_TIMING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "metrics.h"
+
+/*
+ * Built with --enable-process-timing, the JACK thread reads the cycle
+ * counter around every process callback and writes the duration to a lock
+ * free ring.  The main thread drains the ring into an HDR style histogram:
+ * each power of 2 of nanoseconds is split into PROCESS_TIMING_SUB_BUCKETS
+ * linear buckets, so every time is kept to within 1/16th.  Without it the
+ * calls below compile to nothing.
+ */
+#define PROCESS_TIMING_SUB_BITS 4
+#define PROCESS_TIMING_SUB_BUCKETS (1 << PROCESS_TIMING_SUB_BITS)
+/* up to 2^32 ns, over 4 seconds */
+#define PROCESS_TIMING_BUCKETS ((32 - PROCESS_TIMING_SUB_BITS + 1) \
+		* PROCESS_TIMING_SUB_BUCKETS)
+/* periods the ring holds between drains */
+#define PROCESS_TIMING_RING 4096
+
+/* A period as the JACK thread records it */
+struct process_timing_record_t {
+	uint32_t ticks;
+	uint32_t nframes;
+};
+
+struct process_timing_t {
+	jack_ringbuffer_t *ring;
+	/* periods lost because the ring was full */
+	atomic_uint dropped;
+	jack_nframes_t sample_rate;
+
+	/* the cycle counter against the clock when timing started */
+	uint64_t start_ticks;
+	uint64_t start_ns;
+	double ns_per_tick;
+
+	/* main thread only */
+	uint64_t count;
+	uint64_t bucket[PROCESS_TIMING_BUCKETS];
+	uint64_t min_ns;
+	uint64_t max_ns;
+	double sum_ns;
+	/* the largest share of its period a callback took */
+	double max_load;
+	/* the --metrics timing the drained periods also go to, or NULL */
+	struct metrics_timing_t *metrics;
+};
+
+/* The summary of the periods drained so far, times in nanoseconds */
+struct process_timing_stats_t {
+	uint64_t count;
+	unsigned int dropped;
+	double min;
+	double mean;
+	double p50;
+	double p99;
+	double p999;
+	double max;
+	/* the largest share of its period a callback took, from 0 to 1 */
+	double max_load;
+};
+
+#ifdef PROCESS_TIMING
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/* The cycle counter, or the raw monotonic clock where there is none */
+static inline uint64_t process_timing_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+/* Record a period, called by the JACK thread */
+static inline void process_timing_record(struct process_timing_t *timing,
+		uint64_t start, uint64_t end, jack_nframes_t nframes) {
+	struct process_timing_record_t record;
+	uint64_t ticks = end - start;
+	record.ticks = ticks > UINT32_MAX ? UINT32_MAX : (uint32_t) ticks;
+	record.nframes = nframes;
+	if (jack_ringbuffer_write_space(timing->ring) < sizeof(record)) {
+		atomic_fetch_add_explicit(&timing->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	jack_ringbuffer_write(timing->ring, (const char*) &record, sizeof(record));
+}
+
+#else
+
+/* Nothing is timed, these compile away */
+static inline uint64_t process_timing_now(void) {
+	return 0;
+}
+
+static inline void process_timing_record(struct process_timing_t *timing,
+		uint64_t start, uint64_t end, jack_nframes_t nframes) {
+}
+
+#endif /* PROCESS_TIMING */
+
+/**
+ * create the ring, does nothing without --enable-process-timing.
+ * @return 0 on success, -1 if the ring could not be allocated
+ */
+int process_timing_init(struct process_timing_t *timing,
+		jack_nframes_t sample_rate);
+
+void process_timing_free(struct process_timing_t *timing);
+
+/* Move the recorded periods into the histogram, called by the main thread */
+void process_timing_drain(struct process_timing_t *timing);
+
+/**
+ * the time below which a share of the periods drained so far fall.
+ * @param q from 0 to 1
+ * @return the time in nanoseconds, 0 if nothing was timed
+ */
+double process_timing_percentile(struct process_timing_t *timing, double q);
+
+/**
+ * summarise the periods drained so far.
+ * @return 0 on success, -1 when process timing is not built in
+ */
+int process_timing_stats(struct process_timing_t *timing,
+		struct process_timing_stats_t *stats);
+
+#endif /* PROCESS_TIMING_H */
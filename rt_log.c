@@ -0,0 +1,72 @@
+/*
+ rt_log.c
+ Realtime safe event log for cuimhne_jackmeter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rt_log.h"
+
+int rt_log_init(struct rt_log *log, size_t events, unsigned int level) {
+	log->level = level;
+	atomic_init(&log->dropped, 0);
+	log->ring = jack_ringbuffer_create(events * sizeof(struct rt_event));
+	if (log->ring == NULL) {
+		return -1;
+	}
+	// keep the ring out of swap so the JACK thread never faults on it
+	jack_ringbuffer_mlock(log->ring);
+	return 0;
+}
+
+void rt_log_free(struct rt_log *log) {
+	if (log->ring) {
+		jack_ringbuffer_free(log->ring);
+		log->ring = NULL;
+	}
+}
+
+void rt_log_event(struct rt_log *log, unsigned int level,
+		enum rt_event_type type, unsigned int channel, int count, float value) {
+	if (level > log->level || log->ring == NULL) {
+		return;
+	}
+	if (jack_ringbuffer_write_space(log->ring) < sizeof(struct rt_event)) {
+		atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	struct rt_event event;
+	event.type = type;
+	event.level = level;
+	event.channel = channel;
+	event.count = count;
+	event.value = value;
+	jack_ringbuffer_write(log->ring, (const char*) &event,
+			sizeof(struct rt_event));
+}
+
+int rt_log_next(struct rt_log *log, struct rt_event *event) {
+	if (log->ring == NULL
+			|| jack_ringbuffer_read_space(log->ring) < sizeof(struct rt_event)) {
+		return 0;
+	}
+	jack_ringbuffer_read(log->ring, (char*) event, sizeof(struct rt_event));
+	return 1;
+}
@@ -0,0 +1,85 @@
+/*
+ rt_log.h
+ Realtime safe event log for cuimhne_jackmeter
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef RT_LOG_H
+#define RT_LOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <jack/ringbuffer.h>
+
+/*
+ * Events raised from the JACK callbacks.  The callbacks may not do formatted
+ * I/O, so they record fixed size events in a lock free ring that the main
+ * thread drains and formats.
+ */
+enum rt_event_type {
+	RT_EVENT_PORT_DISABLED, /* channel has no registered port */
+	RT_EVENT_PEAK, /* period peak of a channel */
+	RT_EVENT_XRUN, /* xrun reported by JACK, count is the new total */
+	RT_EVENT_RMS_WINDOW /* RMS window cut short, count is the period */
+};
+
+struct rt_event {
+	uint8_t type;
+	uint8_t level;
+	uint16_t channel;
+	int32_t count;
+	float value;
+};
+
+/*
+ * A single producer, single consumer event ring.  Each callback thread that
+ * raises events needs its own rt_log.
+ */
+struct rt_log {
+	jack_ringbuffer_t *ring;
+	/* events are not recorded above this debug level */
+	unsigned int level;
+	/* events lost because the ring was full */
+	atomic_uint dropped;
+};
+
+/**
+ * create the ring for a log.
+ * @param log the log to initialise
+ * @param events the number of events the ring can hold
+ * @param level the highest debug level that is recorded
+ * @return 0 on success, -1 if the ring could not be created
+ */
+int rt_log_init(struct rt_log *log, size_t events, unsigned int level);
+
+void rt_log_free(struct rt_log *log);
+
+/**
+ * record an event.  Safe to call from the JACK thread: it never blocks or
+ * allocates, and drops the event when the ring is full.
+ */
+void rt_log_event(struct rt_log *log, unsigned int level,
+		enum rt_event_type type, unsigned int channel, int count, float value);
+
+/**
+ * take the oldest event from the log.
+ * @return 1 if an event was read, 0 if the log is empty
+ */
+int rt_log_next(struct rt_log *log, struct rt_event *event);
+
+#endif /* RT_LOG_H */
@@ -0,0 +1,206 @@
+/*
+ wav_file.c
+ Memory mapped WAV file reader
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wav_file.h"
+
+/* WAV files are little endian whatever the host is */
+static uint16_t get_u16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static const char* parse_fmt(struct wav_file_t *wav, const unsigned char *fmt,
+		uint32_t size) {
+	if (size < 16) {
+		return "fmt chunk is too short";
+	}
+	wav->format = get_u16(fmt);
+	wav->channels = get_u16(fmt + 2);
+	wav->sample_rate = get_u32(fmt + 4);
+	wav->block_align = get_u16(fmt + 12);
+	wav->bytes_per_sample = (get_u16(fmt + 14) + 7) / 8;
+	if (wav->format == WAVE_FORMAT_EXTENSIBLE) {
+		if (size < 40) {
+			return "extensible fmt chunk is too short";
+		}
+		// the format is the start of the sub format GUID
+		wav->format = get_u16(fmt + 24);
+	}
+	if (wav->channels == 0 || wav->sample_rate == 0) {
+		return "no channels or no sample rate";
+	}
+	if (wav->format == WAVE_FORMAT_PCM) {
+		if (wav->bytes_per_sample < 1 || wav->bytes_per_sample > 4) {
+			return "only 8 to 32 bit PCM is supported";
+		}
+	} else if (wav->format == WAVE_FORMAT_IEEE_FLOAT) {
+		if (wav->bytes_per_sample != 4 && wav->bytes_per_sample != 8) {
+			return "only 32 and 64 bit float is supported";
+		}
+	} else {
+		return "only PCM and float samples are supported";
+	}
+	if (wav->block_align < wav->channels * wav->bytes_per_sample) {
+		return "block align is smaller than a frame";
+	}
+	return NULL;
+}
+
+static const char* parse_chunks(struct wav_file_t *wav) {
+	const unsigned char *p = wav->map;
+	const unsigned char *end = wav->map + wav->map_size;
+	int have_fmt = 0;
+	if (wav->map_size < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+		return "not a RIFF WAVE file";
+	}
+	p += 12;
+	while (end - p >= 8) {
+		uint32_t size = get_u32(p + 4);
+		const unsigned char *body = p + 8;
+		if (!memcmp(p, "fmt ", 4)) {
+			if (size > (size_t) (end - body)) {
+				return "fmt chunk is truncated";
+			}
+			const char *error = parse_fmt(wav, body, size);
+			if (error) {
+				return error;
+			}
+			have_fmt = 1;
+		} else if (!memcmp(p, "data", 4)) {
+			if (!have_fmt) {
+				return "data chunk before fmt chunk";
+			}
+			// a recording that was cut short keeps the samples it has
+			if (size > (size_t) (end - body)) {
+				size = end - body;
+			}
+			wav->data = body;
+			wav->frames = size / wav->block_align;
+			return NULL;
+		}
+		if (size > (size_t) (end - body)) {
+			break;
+		}
+		// chunks are padded to an even length
+		p = body + size + (size & 1);
+	}
+	return "no data chunk";
+}
+
+const char* wav_file_open(struct wav_file_t *wav, const char *name) {
+	struct stat st;
+	memset(wav, 0, sizeof(struct wav_file_t));
+	wav->fd = open(name, O_RDONLY);
+	if (wav->fd < 0) {
+		return "cannot open the file";
+	}
+	if (fstat(wav->fd, &st) || st.st_size == 0) {
+		wav_file_close(wav);
+		return "cannot read the file size";
+	}
+	wav->map_size = st.st_size;
+	wav->map = mmap(NULL, wav->map_size, PROT_READ, MAP_PRIVATE, wav->fd, 0);
+	if (wav->map == MAP_FAILED) {
+		wav->map = NULL;
+		wav_file_close(wav);
+		return "cannot map the file";
+	}
+	// the file is read once from start to end
+	madvise(wav->map, wav->map_size, MADV_SEQUENTIAL);
+	const char *error = parse_chunks(wav);
+	if (error) {
+		wav_file_close(wav);
+	}
+	return error;
+}
+
+void wav_file_close(struct wav_file_t *wav) {
+	if (wav->map) {
+		munmap(wav->map, wav->map_size);
+		wav->map = NULL;
+	}
+	if (wav->fd >= 0) {
+		close(wav->fd);
+		wav->fd = -1;
+	}
+}
+
+static float get_sample(const struct wav_file_t *wav, const unsigned char *p) {
+	union {
+		uint32_t u;
+		float f;
+	} f32;
+	union {
+		uint64_t u;
+		double d;
+	} f64;
+	if (wav->format == WAVE_FORMAT_IEEE_FLOAT) {
+		if (wav->bytes_per_sample == 4) {
+			f32.u = get_u32(p);
+			return f32.f;
+		}
+		f64.u = get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+		return (float) f64.d;
+	}
+	switch (wav->bytes_per_sample) {
+	case 1:
+		// 8 bit samples are unsigned
+		return (p[0] - 128) * (1.0f / 128.0f);
+	case 2:
+		return (int16_t) get_u16(p) * (1.0f / 32768.0f);
+	case 3:
+		return ((int32_t) ((uint32_t) (p[0] | (p[1] << 8) | (p[2] << 16)) << 8))
+				* (1.0f / 2147483648.0f);
+	default:
+		return (int32_t) get_u32(p) * (1.0f / 2147483648.0f);
+	}
+}
+
+size_t wav_file_read(const struct wav_file_t *wav, size_t first, size_t frames,
+		float *const *buffers) {
+	size_t frame;
+	unsigned int channel;
+	if (first >= wav->frames) {
+		return 0;
+	}
+	if (frames > wav->frames - first) {
+		frames = wav->frames - first;
+	}
+	const unsigned char *p = wav->data + first * wav->block_align;
+	for (frame = 0; frame < frames; frame++) {
+		for (channel = 0; channel < wav->channels; channel++) {
+			buffers[channel][frame] = get_sample(wav,
+					p + channel * wav->bytes_per_sample);
+		}
+		p += wav->block_align;
+	}
+	return frames;
+}
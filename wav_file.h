@@ -0,0 +1,70 @@
+/*
+ wav_file.h
+ Memory mapped WAV file reader
+ Copyright (C) 2023 Claude Warren
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+ */
+
+#ifndef WAV_FILE_H
+#define WAV_FILE_H
+
+#include <stddef.h>
+
+/*
+ * A WAV file mapped into memory.  The samples are converted to float as they
+ * are read, so any part of the file can be read in any order without copying
+ * the file.
+ */
+struct wav_file_t {
+	int fd;
+	unsigned char *map;
+	size_t map_size;
+	/* the first sample frame in the map */
+	const unsigned char *data;
+	size_t frames;
+	unsigned int channels;
+	unsigned int sample_rate;
+	/* WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT */
+	int format;
+	unsigned int bytes_per_sample;
+	unsigned int block_align;
+};
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+/**
+ * map a WAV file.  Integer PCM of 8 to 32 bits and 32 or 64 bit float
+ * samples can be read.
+ * @return NULL on success, or a description of why the file cannot be read
+ */
+const char* wav_file_open(struct wav_file_t *wav, const char *name);
+
+void wav_file_close(struct wav_file_t *wav);
+
+/**
+ * read frames into a float buffer per channel.
+ * @param first the first frame to read
+ * @param frames the number of frames to read
+ * @param buffers a buffer of at least frames samples for each channel
+ * @return the number of frames read, less than frames at the end of the file
+ */
+size_t wav_file_read(const struct wav_file_t *wav, size_t first, size_t frames,
+		float *const *buffers);
+
+#endif /* WAV_FILE_H */